@@ -52,6 +52,10 @@ for f in files:
             if('representative' in c):
                 #print("ignoring rep file ", c)
                 continue
+            if(c.split('/')[-1] == 'perf.csv'): # timings and counters written with PERF_STATS, not run data
+                continue
+            if(c.split('/')[-1] == 'lineage.csv'): # line of descent written with LINEAGE_TRACKING, one row per ancestor
+                continue
             curr_dataframes.append(pd.read_csv(c, index_col="update")) # this works
         # Error check from previous issue I was having, make sure every file is present, otherwise will throw an error
         if len(curr_dataframes) < num_files:
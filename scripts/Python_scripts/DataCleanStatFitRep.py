@@ -40,10 +40,22 @@ for f in files:
         mut_rates = curr.split('_')
         currdata = glob.glob(f + '/*.csv')
         curr_dataframes = []
+        # runs with OUTPUT_COLUMNS set write everything asked for to output.csv
+        if f + '/output.csv' in currdata:
+            merged = pd.read_csv(f + '/output.csv', index_col="update")
+            merged["replicate"] = replicate
+            for i in range(0, len(mut_rates), 2):
+                merged[mut_rates[i]] = mut_rates[i+1]
+            dataframes_stats.append(merged)
+            continue
         # for each file in replicate, grab the data
         for c in currdata:
             if('snapshot' in c): # ignore the snapshot file because not the data we're interested in right now
                 continue
+            if(c.split('/')[-1] == 'perf.csv'): # timings and counters written with PERF_STATS, not run data
+                continue
+            if(c.split('/')[-1] == 'lineage.csv'): # line of descent written with LINEAGE_TRACKING, one row per ancestor
+                continue
             curr_dataframes.append(pd.read_csv(c, index_col="update"))
         # Error check from previous issue I was having, make sure every file is present, otherwise will throw an error
         if len(curr_dataframes) < num_files:
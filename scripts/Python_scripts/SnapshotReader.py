@@ -0,0 +1,111 @@
+# coding: utf-8
+
+# Reader for Aagos binary snapshot files (snapshot.bin, written when BINARY_SNAPSHOT is set).
+# The file is memory mapped and only the block for the requested update is decoded,
+# so single updates can be pulled out of very large snapshot files.
+# See source/AagosSnapshot.h for the layout of the file.
+
+import mmap
+import struct
+import sys
+import argparse as argp
+
+import numpy as np
+import pandas as pd
+
+MAGIC = b'AAGOSSNP'
+VERSION = 1
+FILE_HEADER = struct.Struct('<8sIIII')
+BLOCK_HEADER = struct.Struct('<QIQ')
+
+
+def read_varints(buf, pos, count):
+    """decodes count LEB128 varints starting at pos, returns values and position after them"""
+    vals = np.empty(count, dtype=np.uint64)
+    for i in range(count):
+        val = 0
+        shift = 0
+        while True:
+            byte = buf[pos]
+            pos += 1
+            val |= (byte & 0x7f) << shift
+            shift += 7
+            if not byte & 0x80:
+                break
+        vals[i] = val
+    return vals, pos
+
+
+class SnapshotFile:
+    def __init__(self, filename):
+        self.file = open(filename, 'rb')
+        self.buf = mmap.mmap(self.file.fileno(), 0, access=mmap.ACCESS_READ)
+        magic, version, self.num_genes, self.gene_size, self.num_bins = FILE_HEADER.unpack_from(self.buf, 0)
+        if magic != MAGIC:
+            sys.exit("ERROR: " + filename + " is not an Aagos binary snapshot file")
+        if version != VERSION:
+            sys.exit("ERROR: unsupported snapshot version " + str(version))
+        # offset of each update's block, found by hopping over block headers only.
+        # A run stopped partway through a write leaves a last block that runs past
+        # the end of the file, which is left out
+        self.blocks = {}
+        pos = FILE_HEADER.size
+        while pos + BLOCK_HEADER.size <= len(self.buf):
+            update, num_orgs, payload_bytes = BLOCK_HEADER.unpack_from(self.buf, pos)
+            if pos + BLOCK_HEADER.size + payload_bytes > len(self.buf):
+                break
+            self.blocks[update] = pos
+            pos += BLOCK_HEADER.size + payload_bytes
+        if pos < len(self.buf):
+            print("WARNING: " + filename + " ends in a truncated block, which was dropped", file=sys.stderr)
+
+    def updates(self):
+        return sorted(self.blocks.keys())
+
+    def read_update(self, update):
+        """returns one update as a dataframe with the same columns as snapshot.csv"""
+        pos = self.blocks[update]
+        _, num_orgs, _ = BLOCK_HEADER.unpack_from(self.buf, pos)
+        pos += BLOCK_HEADER.size
+        fitness = np.frombuffer(self.buf, dtype='<f8', count=num_orgs, offset=pos)
+        pos += 8 * num_orgs
+        neighbors = np.frombuffer(self.buf, dtype='<f8', count=num_orgs, offset=pos)
+        pos += 8 * num_orgs
+        sizes = np.frombuffer(self.buf, dtype='<u4', count=num_orgs, offset=pos)
+        pos += 4 * num_orgs
+        genomes = []
+        for size in sizes:
+            num_words = (int(size) + 31) // 32
+            words = np.frombuffer(self.buf, dtype='<u4', count=num_words, offset=pos)
+            pos += 4 * num_words
+            bits = np.unpackbits(words.view(np.uint8), bitorder='little')[:size]
+            genomes.append(''.join(bits.astype(str)))
+        starts, pos = read_varints(self.buf, pos, num_orgs * self.num_genes)
+        starts = starts.reshape(num_orgs, self.num_genes)
+        hist, pos = read_varints(self.buf, pos, num_orgs * self.num_bins)
+        hist = hist.reshape(num_orgs, self.num_bins)
+
+        data = pd.DataFrame({'update': np.full(num_orgs, update)})
+        for b in range(self.num_bins):
+            data[str(b) + '_gene_overlap_frequency'] = hist[:, b]
+        data['gene_starts'] = ['[ ' + ' '.join(str(s) for s in row) + ' ]' for row in starts]
+        data['genome_size'] = sizes
+        data['fitness'] = fitness
+        data['gene_neighbors'] = neighbors
+        data['genome'] = genomes
+        return data.set_index('update')
+
+
+if __name__ == '__main__':
+    parser = argp.ArgumentParser(description='Read updates out of an Aagos binary snapshot file.')
+    parser.add_argument("-f", type=str, required=True, help="path to snapshot.bin file")
+    parser.add_argument("-u", type=int, help="update to extract. If not given, lists all updates in file")
+    parser.add_argument("-o", type=str, help="csv file to write update to, defaults to stdout")
+    args = parser.parse_args()
+    snapshots = SnapshotFile(args.f)
+    if args.u is None:
+        print('\n'.join(str(u) for u in snapshots.updates()))
+    elif args.u not in snapshots.blocks:
+        sys.exit("ERROR: update " + str(args.u) + " not in snapshot file")
+    else:
+        snapshots.read_update(args.u).to_csv(args.o if args.o else sys.stdout)
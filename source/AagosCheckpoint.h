@@ -0,0 +1,142 @@
+#ifndef AAGOS_CHECKPOINT_H
+#define AAGOS_CHECKPOINT_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include "base/vector.h"
+#include "tools/Random.h"
+
+#include "AagosSnapshot.h"
+
+// Checkpoint format, all values little endian. Random number generators are
+// stored as raw bytes, so a checkpoint can only be resumed by the same build
+// it was written by:
+//
+//   char[8]  magic "AAGOSCKP"
+//   uint32   format version
+//   uint32   bytes per random number generator
+//   uint64   update
+//   uint32   num genes, gene size, gradient model flag, num worker generators,
+//            num environments
+//   raw      world generator, then each worker generator
+//   uint64   bytes of binary snapshot file written (0 without binary snapshots)
+//   uint32   num csv data files, then uint64 bytes written to each, in the
+//            order the world opens them
+//   each environment, either
+//     uint32   packed target of each gene (gradient model)
+//     uint32   states per gene, then float64 fitness of each state of each gene
+//     uint32   0, then (hashed landscape)
+//              uint64   landscape seed
+//              uint64   num redrawn states
+//              uint32   gene, state and times redrawn of each redrawn state
+//   uint32   num orgs
+//   per org
+//     uint32   genome size
+//     uint32   packed genome words, ceil(genome size / 32)
+//     uint32   gene starts, num genes
+//   uint32   num orgs with a lineage node (0 until LINEAGE_TRACKING has started), then
+//     uint32   lineage node of each org
+//     raw      lineage tree, see AagosLineage::Save
+//
+// Island runs write one checkpoint per deme, deme_<k>/checkpoint_<update>.bin,
+// then publish them together with a manifest in checkpoint.bin:
+//
+//   char[8]  magic "AAGOSISL"
+//   uint32   format version
+//   uint64   update
+//   uint32   num demes
+namespace AagosCheckpoint
+{
+  constexpr char MAGIC[8] = {'A', 'A', 'G', 'O', 'S', 'C', 'K', 'P'};
+  constexpr char ISLANDS_MAGIC[8] = {'A', 'A', 'G', 'O', 'S', 'I', 'S', 'L'};
+  constexpr uint32_t VERSION = 5;
+
+  inline void PutRandom(emp::vector<unsigned char> &out, const emp::Random &random)
+  {
+    const unsigned char *raw = (const unsigned char *)&random;
+    out.insert(out.end(), raw, raw + sizeof(emp::Random));
+  }
+
+  // reads checkpoint values back in the order they were written. Reads past the
+  // end of the data return 0 and mark the cursor as failed
+  class Cursor
+  {
+  private:
+    const emp::vector<unsigned char> &in;
+    size_t pos;
+    bool ok;
+
+    bool Take(size_t num_bytes)
+    {
+      ok = ok && pos + num_bytes <= in.size();
+      return ok;
+    }
+
+  public:
+    Cursor(const emp::vector<unsigned char> &_in) : in(_in), pos(0), ok(true) { ; }
+
+    bool IsOk() const { return ok; }
+
+    bool GetMagic(const char *magic = MAGIC)
+    {
+      if (!Take(8))
+        return false;
+      pos += 8;
+      return std::memcmp(&in[pos - 8], magic, 8) == 0;
+    }
+
+    uint64_t GetUInt(size_t num_bytes)
+    {
+      if (!Take(num_bytes))
+        return 0;
+      pos += num_bytes;
+      return AagosSnapshot::GetUInt(&in[pos - num_bytes], num_bytes);
+    }
+
+    double GetDouble()
+    {
+      if (!Take(8))
+        return 0.0;
+      pos += 8;
+      return AagosSnapshot::GetDouble(&in[pos - 8]);
+    }
+
+    void GetRandom(emp::Random &random)
+    {
+      if (!Take(sizeof(emp::Random)))
+        return;
+      std::copy(&in[pos], &in[pos] + sizeof(emp::Random), (unsigned char *)&random);
+      pos += sizeof(emp::Random);
+    }
+  };
+
+  // writes data to a temporary file and renames it over filename, so a run
+  // stopped partway through a write still leaves the last checkpoint intact
+  inline bool WriteFile(const std::string &filename, const emp::vector<unsigned char> &data)
+  {
+    const std::string temp_filename = filename + ".tmp";
+    {
+      std::ofstream file(temp_filename, std::ios::binary);
+      if (!file.write((const char *)data.data(), (std::streamsize)data.size()))
+        return false;
+    }
+    return std::rename(temp_filename.c_str(), filename.c_str()) == 0;
+  }
+
+  inline bool ReadFile(const std::string &filename, emp::vector<unsigned char> &data)
+  {
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file)
+      return false;
+    data.resize((size_t)file.tellg());
+    file.seekg(0);
+    return (bool)file.read((char *)data.data(), (std::streamsize)data.size());
+  }
+}
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef AAGOS_COVERAGE_H
+#define AAGOS_COVERAGE_H
+
+#include <cstddef>
+
+#include "base/vector.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Kernels for the per-site gene coverage and coverage histogram of a genome.
+// Builds with SSE2 (all x86-64 builds) run the prefix sum four sites at a
+// time; other builds, including the web build, use the scalar loop. Both give
+// exactly the same coverage, since only integer additions are involved
+namespace AagosCoverage
+{
+  // turns a difference array into running totals in place, one site at a time
+  inline void PrefixSumScalar(int *values, size_t n)
+  {
+    int total = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+      total += values[i];
+      values[i] = total;
+    }
+  }
+
+  // turns a difference array into running totals in place
+  inline void PrefixSum(int *values, size_t n)
+  {
+#ifdef __SSE2__
+    size_t i = 0;
+    __m128i carry = _mm_setzero_si128(); // running total before the current block, in every lane
+    for (; i + 4 <= n; i += 4)
+    {
+      __m128i block = _mm_loadu_si128((const __m128i *)(values + i));
+      // each lane picks up the lanes before it in two shifted adds
+      block = _mm_add_epi32(block, _mm_slli_si128(block, 4));
+      block = _mm_add_epi32(block, _mm_slli_si128(block, 8));
+      block = _mm_add_epi32(block, carry);
+      _mm_storeu_si128((__m128i *)(values + i), block);
+      carry = _mm_shuffle_epi32(block, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+    int total = _mm_cvtsi128_si32(carry);
+    for (; i < n; i++)
+    {
+      total += values[i];
+      values[i] = total;
+    }
+#else
+    PrefixSumScalar(values, n);
+#endif
+  }
+
+  // adds one to the bin of hist_counts for each site's coverage. Neighboring
+  // sites nearly always have the same coverage, so sites are spread over four
+  // sets of bins that are summed at the end, rather than each increment
+  // waiting on the one before it
+  inline void CountBins(const int *coverage, size_t n, size_t *hist_counts, size_t num_bins)
+  {
+    static thread_local emp::vector<size_t> lanes;
+    lanes.assign(4 * num_bins, 0);
+    size_t *lane_0 = lanes.data();
+    size_t *lane_1 = lane_0 + num_bins;
+    size_t *lane_2 = lane_1 + num_bins;
+    size_t *lane_3 = lane_2 + num_bins;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+      lane_0[(size_t)coverage[i]]++;
+      lane_1[(size_t)coverage[i + 1]]++;
+      lane_2[(size_t)coverage[i + 2]]++;
+      lane_3[(size_t)coverage[i + 3]]++;
+    }
+    for (; i < n; i++)
+      lane_0[(size_t)coverage[i]]++;
+    for (size_t bin = 0; bin < num_bins; bin++)
+      hist_counts[bin] += lane_0[bin] + lane_1[bin] + lane_2[bin] + lane_3[bin];
+  }
+}
+
+#endif
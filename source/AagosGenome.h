@@ -0,0 +1,307 @@
+#ifndef AAGOS_GENOME_H
+#define AAGOS_GENOME_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+#include "base/vector.h"
+#include "tools/BitVector.h"
+#include "tools/Random.h"
+#include "tools/random_utils.h"
+
+#include "CowPtr.h"
+
+// Fixed-size genome slots stored back to back in one array, so a population's
+// genomes sit in contiguous memory and copying a genome never allocates. Slots
+// are only handed out and returned as orgs are created and destroyed, which
+// the world always does from a single thread
+class AagosGenomePool
+{
+private:
+  // 32-bit words in each slot, enough for the largest genome allowed plus its
+  // wrap word (see AagosGenome)
+  size_t slot_words;
+  emp::vector<uint32_t> words;
+  emp::vector<size_t> free_slots;
+
+public:
+  AagosGenomePool(size_t max_bits)
+      : slot_words((max_bits + 31) / 32 + 1)
+      , words()
+      , free_slots()
+  {
+    emp_assert(max_bits > 0, max_bits);
+  }
+
+  AagosGenomePool(const AagosGenomePool &) = delete;
+  AagosGenomePool &operator=(const AagosGenomePool &) = delete;
+
+  size_t GetSlotWords() const { return slot_words; }
+  // total slots ever handed out, whether or not they are in use now
+  size_t GetNumSlots() const { return words.size() / slot_words; }
+
+  // reuses a released slot if there is one, otherwise grows the pool
+  size_t Acquire()
+  {
+    if (free_slots.size())
+    {
+      const size_t slot = free_slots.back();
+      free_slots.pop_back();
+      return slot;
+    }
+    words.resize(words.size() + slot_words);
+    return GetNumSlots() - 1;
+  }
+
+  void Release(size_t slot) { free_slots.push_back(slot); }
+
+  // only valid until the next Acquire, which may move the pool
+  uint32_t *GetSlot(size_t slot) { return words.data() + slot * slot_words; }
+};
+
+// Bitstring genome of an org, packed into 32-bit words. The genome is circular,
+// so the 32 bits stored right after its last bit always repeat the bits at the
+// start of the genome (over and over for genomes shorter than 32 bits), and any
+// bits after those are clear. Reading up to 32 bits from any position, even one
+// that runs off the end, is then just two word loads. The words live in a slot
+// of a pool when the genome is given one, and otherwise in a vector shared
+// copy-on-write with the genome's copies, so copying an unpooled genome is free
+// until one of the copies is changed. Copies share the pool of the genome they
+// were copied from.
+class AagosGenome
+{
+private:
+  size_t num_bits;
+  std::shared_ptr<AagosGenomePool> pool; // null when genome isn't pooled
+  size_t slot;
+  CowPtr<emp::vector<uint32_t>> own_words;
+
+  // words to change, no longer shared with any copy
+  uint32_t *Words() { return pool ? pool->GetSlot(slot) : own_words.Mutable().data(); }
+  const uint32_t *Words() const { return pool ? pool->GetSlot(slot) : own_words.Get().data(); }
+
+  // words of storage, one more than the genome itself for the wrapped bits
+  size_t StorageWords() const { return NumWords() + 1; }
+
+  // sets up storage for the current num_bits, without clearing it
+  void Allocate()
+  {
+    if (pool)
+    {
+      emp_assert(StorageWords() <= pool->GetSlotWords(), "genome doesn't fit in pool slot", num_bits);
+      slot = pool->Acquire();
+    }
+    else
+      own_words.Mutable().resize(StorageWords());
+  }
+
+  // sets a word of the genome, clearing any bits past its end. The wrapped bits
+  // must be refreshed by the caller afterwards
+  void SetWord(size_t word, uint32_t val)
+  {
+    emp_assert(word < NumWords(), word, NumWords());
+    if (word == NumWords() - 1 && num_bits % 32)
+      val &= emp::MaskLow<uint32_t>(num_bits % 32);
+    Words()[word] = val;
+  }
+
+  // copies the first bits of the genome into the 32 bits after its end
+  void RefreshWrap()
+  {
+    if (num_bits == 0)
+      return;
+    uint32_t *words = Words();
+    uint32_t wrap = words[0];
+    if (num_bits < 32)
+    {
+      const uint32_t head = wrap & emp::MaskLow<uint32_t>(num_bits);
+      wrap = 0;
+      for (size_t shift = 0; shift < 32; shift += num_bits)
+        wrap |= head << shift;
+    }
+    const size_t word = num_bits / 32;
+    const size_t shift = num_bits % 32;
+    if (shift)
+    {
+      words[word] = (words[word] & emp::MaskLow<uint32_t>(shift)) | (wrap << shift);
+      words[word + 1] = wrap >> (32 - shift);
+    }
+    else
+      words[word] = wrap;
+  }
+
+public:
+  AagosGenome(size_t _num_bits = 0, std::shared_ptr<AagosGenomePool> _pool = nullptr)
+      : num_bits(_num_bits)
+      , pool(_pool)
+      , slot(0)
+      , own_words()
+  {
+    Allocate();
+    std::fill(Words(), Words() + StorageWords(), 0);
+  }
+
+  AagosGenome(const AagosGenome &other)
+      : num_bits(other.num_bits)
+      , pool(other.pool)
+      , slot(0)
+      , own_words(other.own_words)
+  {
+    if (pool)
+    {
+      Allocate();
+      std::memcpy(Words(), other.Words(), StorageWords() * sizeof(uint32_t));
+    }
+  }
+
+  AagosGenome(AagosGenome &&other)
+      : num_bits(other.num_bits)
+      , pool(std::move(other.pool))
+      , slot(other.slot)
+      , own_words(std::move(other.own_words))
+  {
+    other.pool = nullptr;
+    other.num_bits = 0;
+  }
+
+  ~AagosGenome()
+  {
+    if (pool)
+      pool->Release(slot);
+  }
+
+  AagosGenome &operator=(const AagosGenome &other)
+  {
+    if (this == &other)
+      return *this;
+    if (pool != other.pool)
+    {
+      if (pool)
+        pool->Release(slot);
+      pool = other.pool;
+      num_bits = other.num_bits;
+      if (pool)
+        Allocate();
+    }
+    num_bits = other.num_bits;
+    if (pool)
+      std::memcpy(Words(), other.Words(), StorageWords() * sizeof(uint32_t));
+    else
+      own_words = other.own_words;
+    return *this;
+  }
+
+  AagosGenome &operator=(AagosGenome &&other)
+  {
+    if (this == &other)
+      return *this;
+    if (pool)
+      pool->Release(slot);
+    num_bits = other.num_bits;
+    pool = std::move(other.pool);
+    slot = other.slot;
+    own_words = std::move(other.own_words);
+    other.pool = nullptr;
+    other.num_bits = 0;
+    return *this;
+  }
+
+  size_t size() const { return num_bits; }
+  size_t GetSize() const { return num_bits; }
+  size_t NumWords() const { return (num_bits + 31) / 32; }
+
+  bool Get(size_t index) const
+  {
+    emp_assert(index < num_bits, index, num_bits);
+    return (Words()[index / 32] >> (index % 32)) & 1;
+  }
+
+  void Toggle(size_t index)
+  {
+    emp_assert(index < num_bits, index, num_bits);
+    uint32_t *words = Words();
+    // the bit and each of its copies among the wrapped bits
+    for (size_t pos = index; pos < num_bits + 32; pos += num_bits)
+      words[pos / 32] ^= (uint32_t)1 << (pos % 32);
+  }
+
+  // word of the genome, with bits past its end read as 0
+  uint32_t GetUInt(size_t word) const
+  {
+    emp_assert(word < NumWords(), word, NumWords());
+    if (word == NumWords() - 1 && num_bits % 32)
+      return Words()[word] & emp::MaskLow<uint32_t>(num_bits % 32);
+    return Words()[word];
+  }
+
+  void SetUInt(size_t word, uint32_t val)
+  {
+    SetWord(word, val);
+    RefreshWrap();
+  }
+
+  // the 32 bits starting at index, continuing around to the start of the genome
+  // when they run off its end. Always exactly two word loads
+  uint32_t GetUIntAtBit(size_t index) const
+  {
+    emp_assert(index < num_bits, index, num_bits);
+    const uint32_t *words = Words() + index / 32;
+    return (uint32_t)((((uint64_t)words[1] << 32) | words[0]) >> (index % 32));
+  }
+
+  // replaces the genome with num_bits bits taken from words
+  void Assign(const emp::vector<uint32_t> &words, size_t _num_bits)
+  {
+    emp_assert(words.size() >= (_num_bits + 31) / 32);
+    num_bits = _num_bits;
+    if (pool)
+      emp_assert(StorageWords() <= pool->GetSlotWords(), "genome doesn't fit in pool slot", _num_bits);
+    else
+      own_words.Mutable().resize(StorageWords());
+    for (size_t w = 0; w < NumWords(); w++)
+      SetWord(w, words[w]);
+    Words()[NumWords()] = 0;
+    RefreshWrap();
+  }
+
+  // sets every bit with probability 0.5, drawing from random in the same order
+  // as emp::RandomizeBitVector
+  void Randomize(emp::Random &random)
+  {
+    emp::BitVector random_bits(num_bits);
+    emp::RandomizeBitVector(random_bits, random);
+    for (size_t w = 0; w < NumWords(); w++)
+      SetWord(w, random_bits.GetUInt(w));
+    RefreshWrap();
+  }
+
+  emp::BitVector ToBitVector() const
+  {
+    emp::BitVector bits(num_bits);
+    for (size_t w = 0; w < NumWords(); w++)
+      bits.SetUInt(w, GetUInt(w));
+    return bits;
+  }
+
+  // the wrapped bits only depend on the genome, so comparing stored words is enough
+  bool operator==(const AagosGenome &other) const
+  {
+    return num_bits == other.num_bits &&
+           std::equal(Words(), Words() + NumWords(), other.Words());
+  }
+  bool operator!=(const AagosGenome &other) const { return !(*this == other); }
+
+  // prints bits from first to last, like emp::BitVector::PrintArray
+  void PrintArray(std::ostream &out = std::cout) const { ToBitVector().PrintArray(out); }
+};
+
+// prints bits from last to first, like emp::BitVector
+inline std::ostream &operator<<(std::ostream &out, const AagosGenome &genome)
+{
+  return out << genome.ToBitVector();
+}
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef AAGOS_HASHED_LANDSCAPE_H
+#define AAGOS_HASHED_LANDSCAPE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+
+#include "base/assert.h"
+#include "base/vector.h"
+
+// NK fitness tables generated on demand. The fitness of each state of each
+// gene is a hash of the landscape seed, the gene, the state and the number of
+// times that state has been redrawn, so the only thing stored is the redraw
+// count of states that have been redrawn. Memory no longer grows with
+// 2^GENE_SIZE, and redrawing a state is a counter bump
+class AagosHashedLandscape
+{
+private:
+  uint64_t seed;
+  size_t num_genes;
+  size_t state_count;
+  // times each redrawn state has been redrawn, keyed by gene and state
+  std::unordered_map<uint64_t, uint32_t> redraws;
+  emp::vector<size_t> gene_redraws; // number of redrawn states of each gene
+
+  static uint64_t Key(size_t gene_id, size_t state) { return ((uint64_t)gene_id << 32) | (uint64_t)state; }
+
+  // splitmix64 finalizer, spreads every input bit over the whole output
+  static uint64_t Mix(uint64_t x)
+  {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+  }
+
+public:
+  AagosHashedLandscape(uint64_t _seed, size_t _num_genes, size_t gene_size)
+      : seed(_seed)
+      , num_genes(_num_genes)
+      , state_count((size_t)1 << gene_size)
+      , redraws()
+      , gene_redraws(_num_genes, 0)
+  {
+    emp_assert(gene_size <= 32, "gene states are keyed by 32 bits", gene_size);
+  }
+
+  uint64_t GetSeed() const { return seed; }
+  size_t GetStateCount() const { return state_count; }
+  const std::unordered_map<uint64_t, uint32_t> &GetRedraws() const { return redraws; }
+
+  // fitness in [0, 1) of a gene in a given state
+  double GetFitness(size_t gene_id, size_t state) const
+  {
+    emp_assert(gene_id < num_genes && state < state_count, gene_id, state);
+    uint64_t epoch = 0;
+    if (gene_redraws[gene_id])
+    {
+      auto redraw = redraws.find(Key(gene_id, state));
+      if (redraw != redraws.end())
+        epoch = redraw->second;
+    }
+    const uint64_t hash = Mix(Mix(seed ^ Mix(Key(gene_id, state))) + epoch);
+    return (double)(hash >> 11) * (1.0 / 9007199254740992.0); // top 53 bits over 2^53
+  }
+
+  // gives a state a new fitness
+  void Redraw(size_t gene_id, size_t state)
+  {
+    emp_assert(gene_id < num_genes && state < state_count, gene_id, state);
+    uint32_t &count = redraws[Key(gene_id, state)];
+    if (count == 0)
+      gene_redraws[gene_id]++;
+    count++;
+  }
+
+  // restores the redraw count of a state, e.g. from a checkpoint
+  void SetRedraws(size_t gene_id, size_t state, uint32_t count)
+  {
+    emp_assert(gene_id < num_genes && state < state_count && count > 0, gene_id, state, count);
+    uint32_t &old_count = redraws[Key(gene_id, state)];
+    if (old_count == 0)
+      gene_redraws[gene_id]++;
+    old_count = count;
+  }
+
+  // gene and state a key of GetRedraws refers to
+  static size_t KeyGene(uint64_t key) { return (size_t)(key >> 32); }
+  static size_t KeyState(uint64_t key) { return (size_t)(key & 0xffffffffULL); }
+};
+
+#endif
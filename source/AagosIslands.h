@@ -0,0 +1,264 @@
+#ifndef AAGOS_ISLANDS_H
+#define AAGOS_ISLANDS_H
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+
+#include "base/vector.h"
+#include "tools/Random.h"
+#include "tools/string_utils.h"
+
+#include "AagosCheckpoint.h"
+#include "AagosWorld.h"
+#include "ThreadPool.h"
+
+// Island model: POP_SIZE split as evenly as it goes into NUM_DEMES demes, the
+// first POP_SIZE % NUM_DEMES getting one org more than the rest. Each deme is an
+// AagosWorld with its own random stream, data files under DATA_FILEPATH/deme_<k>/
+// and NUM_THREADS of 1. Demes are spread over a pool of NUM_THREADS threads and run on their own
+// until the next migration, so threads only wait on each other every
+// MIGRATION_INTERVAL updates. At a migration each deme copies MIGRATION_COUNT
+// random orgs into its outbox, then, once every outbox is full, each deme
+// replaces random residents with the orgs in its neighbors' outboxes. Outboxes
+// are only written by their own deme and only read after the pool's barrier, so
+// no locking is needed, and every draw comes from a deme's own stream, so runs
+// come out the same for any number of threads. Checkpoints are taken here
+// rather than by the demes, once every deme has reached the same update
+class AagosIslands
+{
+public:
+  enum Topology
+  {
+    RING, // each deme sends to the next, the last to the first
+    ALL   // each deme sends to every other deme
+  };
+
+private:
+  // an org on its way to another deme, stored as plain data so it isn't tied to
+  // the genome pool of the deme it left
+  struct Migrant
+  {
+    size_t num_bits;
+    emp::vector<uint32_t> words;
+    emp::vector<size_t> gene_starts;
+  };
+
+  size_t num_demes;
+  size_t migration_interval;
+  size_t migration_count;
+  Topology topology;
+  size_t checkpoint_interval;
+  std::string data_filepath;
+  size_t checkpoint_update; // update of the last checkpoint published, 0 for none
+  emp::vector<std::unique_ptr<AagosConfig>> deme_configs;
+  emp::vector<std::unique_ptr<emp::Random>> deme_randoms;
+  emp::vector<std::unique_ptr<AagosWorld>> demes;
+  emp::vector<emp::vector<Migrant>> outboxes;
+  ThreadPool thread_pool;
+
+  // copies migration_count random orgs of deme k into its outbox
+  void PickEmigrants(size_t k)
+  {
+    AagosWorld &deme = *demes[k];
+    emp::vector<Migrant> &outbox = outboxes[k];
+    outbox.resize(migration_count);
+    for (Migrant &migrant : outbox)
+    {
+      const AagosOrg &org = deme[deme.GetRandom().GetUInt(deme.GetSize())];
+      migrant.num_bits = org.GetNumBits();
+      migrant.words.resize(org.GetBits().NumWords());
+      for (size_t w = 0; w < migrant.words.size(); w++)
+        migrant.words[w] = org.GetBits().GetUInt(w);
+      migrant.gene_starts = org.GetGeneStarts();
+    }
+  }
+
+  // replaces random residents of deme k with the emigrants of its neighbors
+  void TakeImmigrants(size_t k)
+  {
+    AagosWorld &deme = *demes[k];
+    for (size_t source = 0; source < num_demes; source++)
+    {
+      if (!IsNeighbor(source, k))
+        continue;
+      for (const Migrant &migrant : outboxes[source])
+        deme.ReplaceGenome(deme.GetRandom().GetUInt(deme.GetSize()), migrant.words, migrant.num_bits,
+                           migrant.gene_starts);
+    }
+  }
+
+  // NUM_DEMES, cut down to POP_SIZE so every deme gets at least one org
+  static size_t DemeCount(AagosConfig &config)
+  {
+    const size_t count = std::max<size_t>(std::min(config.NUM_DEMES(), config.POP_SIZE()), 1);
+    if (count != config.NUM_DEMES())
+      std::cerr << "NUM_DEMES of " << config.NUM_DEMES() << " doesn't fit a POP_SIZE of " << config.POP_SIZE()
+                << ", using " << count << std::endl;
+    return count;
+  }
+
+  std::string DemeCheckpointFile(const std::string &dir, size_t k, size_t checkpoint) const
+  {
+    return dir + "deme_" + emp::to_string(k) + "/checkpoint_" + emp::to_string(checkpoint) + ".bin";
+  }
+
+public:
+  // builds every deme from config, which isn't changed
+  AagosIslands(AagosConfig &config)
+      : num_demes(DemeCount(config))
+      , migration_interval(config.MIGRATION_INTERVAL())
+      , migration_count(config.MIGRATION_COUNT())
+      , topology(RING)
+      , checkpoint_interval(config.CHECKPOINT_INTERVAL())
+      , data_filepath(config.DATA_FILEPATH())
+      , checkpoint_update(0)
+      , deme_configs()
+      , deme_randoms()
+      , demes()
+      , outboxes(num_demes)
+      , thread_pool(std::max<size_t>(std::min(config.NUM_THREADS(), num_demes), 1))
+  {
+    if (config.MIGRATION_TOPOLOGY() == "all")
+      topology = ALL;
+    else if (config.MIGRATION_TOPOLOGY() != "ring")
+      std::cerr << "Unknown MIGRATION_TOPOLOGY " << config.MIGRATION_TOPOLOGY() << ", using ring" << std::endl;
+
+    // deme seeds are drawn from SEED, so a run is reproducible for a given seed
+    emp::Random seed_random(config.SEED());
+    std::stringstream config_text;
+    config.Write(config_text);
+    auto mut_tables = std::make_shared<AagosMutationTables>(config); // shared by every deme
+    for (size_t k = 0; k < num_demes; k++)
+    {
+      deme_configs.emplace_back(new AagosConfig());
+      AagosConfig &deme_config = *deme_configs.back();
+      config_text.clear();
+      config_text.seekg(0);
+      deme_config.Read(config_text);
+      deme_config.POP_SIZE(config.POP_SIZE() / num_demes + (k < config.POP_SIZE() % num_demes));
+      deme_config.NUM_THREADS(1);
+      deme_config.CHECKPOINT_INTERVAL(0); // see SaveCheckpoints
+      deme_config.SEED(seed_random.GetInt(1, std::numeric_limits<int>::max()));
+      deme_config.DATA_FILEPATH(config.DATA_FILEPATH() + "deme_" + emp::to_string(k) + "/");
+      mkdir(deme_config.DATA_FILEPATH().c_str(), 0755);
+      deme_randoms.emplace_back(new emp::Random(deme_config.SEED()));
+      demes.emplace_back(new AagosWorld(*deme_randoms.back(), deme_config, "deme_" + emp::to_string(k), mut_tables));
+    }
+  }
+
+  size_t GetNumDemes() const { return num_demes; }
+  AagosWorld &GetDeme(size_t k) { return *demes[k]; }
+  size_t GetUpdate() const { return demes[0]->GetUpdate(); }
+
+  // whether deme source sends migrants to deme dest
+  bool IsNeighbor(size_t source, size_t dest) const
+  {
+    if (source == dest)
+      return false;
+    return topology == ALL || (source + 1) % num_demes == dest;
+  }
+
+  // fills every deme with randomized organisms
+  void InitPopulation()
+  {
+    for (auto &deme : demes)
+      deme->InitPopulation();
+  }
+
+  // writes a checkpoint of every deme, then publishes them all at once by
+  // renaming the manifest over DATA_FILEPATH/checkpoint.bin. A run stopped
+  // before the rename still resumes from the previous checkpoint, whose deme
+  // files are only removed once the new manifest is in place
+  void SaveCheckpoints()
+  {
+    const size_t update = GetUpdate();
+    emp::vector<char> saved(num_demes, false);
+    thread_pool.RunTasks(num_demes, [this, update, &saved](size_t k, size_t) {
+      saved[k] = demes[k]->SaveCheckpoint(DemeCheckpointFile(data_filepath, k, update));
+    });
+    if (std::find(saved.begin(), saved.end(), false) != saved.end())
+      return; // the deme that failed has already said so
+    emp::vector<unsigned char> data(AagosCheckpoint::ISLANDS_MAGIC, AagosCheckpoint::ISLANDS_MAGIC + 8);
+    AagosSnapshot::PutUInt(data, AagosCheckpoint::VERSION, 4);
+    AagosSnapshot::PutUInt(data, update, 8);
+    AagosSnapshot::PutUInt(data, num_demes, 4);
+    if (!AagosCheckpoint::WriteFile(data_filepath + "checkpoint.bin", data))
+    {
+      std::cerr << "Unable to write checkpoint " << data_filepath << "checkpoint.bin" << std::endl;
+      return;
+    }
+    if (checkpoint_update && checkpoint_update != update)
+    {
+      for (size_t k = 0; k < num_demes; k++)
+        std::remove(DemeCheckpointFile(data_filepath, k, checkpoint_update).c_str());
+    }
+    checkpoint_update = update;
+  }
+
+  // picks every deme up from the checkpoint published in dir/checkpoint.bin.
+  // Returns false if it can't be read, was written with a different NUM_DEMES
+  // or any deme is at a different update than the manifest
+  bool LoadCheckpoints(const std::string &dir)
+  {
+    emp::vector<unsigned char> data;
+    if (!AagosCheckpoint::ReadFile(dir + "checkpoint.bin", data))
+      return false;
+    AagosCheckpoint::Cursor in(data);
+    if (!in.GetMagic(AagosCheckpoint::ISLANDS_MAGIC) || in.GetUInt(4) != AagosCheckpoint::VERSION)
+      return false;
+    const size_t update = in.GetUInt(8);
+    if (in.GetUInt(4) != num_demes || !in.IsOk())
+      return false;
+    for (size_t k = 0; k < num_demes; k++)
+    {
+      if (!demes[k]->LoadCheckpoint(DemeCheckpointFile(dir, k, update)) || demes[k]->GetUpdate() != update)
+        return false;
+    }
+    // only clean up after the resumed checkpoint when it's in this run's own directory
+    checkpoint_update = dir == data_filepath ? update : 0;
+    return true;
+  }
+
+  // runs num_updates updates of every deme. Checkpoints are taken after each
+  // update that is a multiple of CHECKPOINT_INTERVAL and migrations happen at
+  // the start of each update that is a multiple of MIGRATION_INTERVAL, after the
+  // checkpoint for it, so resumed runs migrate exactly where the original did
+  void Run(size_t num_updates)
+  {
+    size_t update = GetUpdate();
+    const size_t end_update = update + num_updates;
+    while (update < end_update)
+    {
+      if (migration_interval && num_demes > 1 && update && update % migration_interval == 0)
+        Migrate();
+      const size_t next_migration = migration_interval ? (update / migration_interval + 1) * migration_interval
+                                                       : end_update;
+      const size_t next_checkpoint = checkpoint_interval
+                                       ? (update / checkpoint_interval + 1) * checkpoint_interval
+                                       : end_update;
+      const size_t chunk_end = std::min({end_update, next_migration, next_checkpoint});
+      thread_pool.RunTasks(num_demes, [this, update, chunk_end](size_t k, size_t) {
+        for (size_t u = update; u < chunk_end; u++)
+          demes[k]->RunUpdate();
+      });
+      update = chunk_end;
+      if (checkpoint_interval && update % checkpoint_interval == 0)
+        SaveCheckpoints();
+    }
+  }
+
+  // swaps migrants between neighboring demes
+  void Migrate()
+  {
+    thread_pool.RunTasks(num_demes, [this](size_t k, size_t) { PickEmigrants(k); });
+    thread_pool.RunTasks(num_demes, [this](size_t k, size_t) { TakeImmigrants(k); });
+  }
+};
+
+#endif
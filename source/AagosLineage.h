@@ -0,0 +1,346 @@
+#ifndef AAGOS_LINEAGE_H
+#define AAGOS_LINEAGE_H
+
+#include <cstddef>
+#include <algorithm>
+#include <cstdint>
+#include <ostream>
+#include <unordered_map>
+
+#include "base/assert.h"
+#include "base/vector.h"
+
+#include "AagosCheckpoint.h"
+
+// Ancestry of the living population, kept as a tree of mutation events. Each
+// node is a genome some org had: a root genome from the start of tracking, or
+// its parent plus the mutations that turned the parent into it. Copies made by
+// selection share their parent's node, so a node is only added when an org
+// mutates. Nodes count the orgs and child nodes pointing at them, and are freed
+// as soon as nothing does, so branches are pruned the generation they go
+// extinct. Nodes and mutations live in two flat arrays, and freed slots in both
+// are reused
+class AagosLineage
+{
+public:
+  static constexpr size_t NO_PARENT = (size_t)-1;
+
+  enum DeltaType : uint8_t
+  {
+    GENE_MOVE,  // gene a moved to start b
+    BIT_FLIP,   // bit a toggled
+    BIT_INSERT, // bit of value b inserted at a
+    BIT_DELETE  // bit at a removed
+  };
+
+  // one mutation. Indels are in the order they were drawn, inserts before
+  // deletes, each position relative to the genome after the one before it
+  struct Delta
+  {
+    uint32_t a;
+    uint32_t b;
+    DeltaType type;
+  };
+
+  // genome of a root node, bits packed 32 to a word, first bit lowest
+  struct RootGenome
+  {
+    size_t num_bits;
+    emp::vector<uint32_t> words;
+    emp::vector<size_t> gene_starts;
+  };
+
+  // mutations of the orgs one worker mutated, to be added in slot order once
+  // every worker is done
+  struct Batch
+  {
+    emp::vector<size_t> slots;
+    emp::vector<size_t> ends; // end of each slot's deltas
+    emp::vector<Delta> deltas;
+
+    void Clear()
+    {
+      slots.resize(0);
+      ends.resize(0);
+      deltas.resize(0);
+    }
+
+    void Add(size_t slot, const emp::vector<Delta> &org_deltas)
+    {
+      slots.push_back(slot);
+      deltas.insert(deltas.end(), org_deltas.begin(), org_deltas.end());
+      ends.push_back(deltas.size());
+    }
+  };
+
+private:
+  struct Node
+  {
+    size_t parent;
+    size_t update; // update the mutations happened on
+    size_t first_delta;
+    uint32_t num_deltas;
+    uint32_t refs; // orgs and child nodes pointing here, 0 once freed
+  };
+
+  emp::vector<Node> nodes;
+  emp::vector<size_t> free_nodes;
+  emp::vector<Delta> deltas;
+  size_t dead_deltas; // deltas of freed nodes, dropped by the next compaction
+  std::unordered_map<size_t, RootGenome> roots;
+
+  size_t NewNode(size_t parent, size_t update)
+  {
+    size_t id = nodes.size();
+    if (free_nodes.size())
+    {
+      id = free_nodes.back();
+      free_nodes.pop_back();
+    }
+    else
+      nodes.emplace_back();
+    nodes[id] = Node{parent, update, deltas.size(), 0, 0};
+    return id;
+  }
+
+  // drops the deltas of freed nodes once they outnumber the live ones
+  void Compact()
+  {
+    if (dead_deltas < 4096 || dead_deltas < deltas.size() - dead_deltas)
+      return;
+    // reused nodes are out of order in deltas, so live ones are copied out rather than moved down
+    emp::vector<Delta> live_deltas;
+    live_deltas.reserve(deltas.size() - dead_deltas);
+    for (Node &node : nodes)
+    {
+      if (!node.refs)
+        continue;
+      const size_t first_delta = live_deltas.size();
+      live_deltas.insert(live_deltas.end(), deltas.begin() + (std::ptrdiff_t)node.first_delta,
+                         deltas.begin() + (std::ptrdiff_t)(node.first_delta + node.num_deltas));
+      node.first_delta = first_delta;
+    }
+    deltas.swap(live_deltas);
+    dead_deltas = 0;
+  }
+
+public:
+  AagosLineage() : nodes(), free_nodes(), deltas(), dead_deltas(0), roots() {}
+
+  // starts a new tree. Nodes start without references, so a node no org is
+  // given is freed by the first Release that reaches it
+  size_t AddRoot(size_t update, const RootGenome &genome)
+  {
+    const size_t id = NewNode(NO_PARENT, update);
+    roots[id] = genome;
+    return id;
+  }
+
+  // adds the genome made by applying org_deltas to parent's genome
+  size_t AddChild(size_t parent, size_t update, const Delta *org_deltas, size_t num_deltas)
+  {
+    emp_assert(parent < nodes.size() && nodes[parent].refs, parent);
+    Compact(); // before the new node, which is given the end of deltas
+    const size_t id = NewNode(parent, update);
+    deltas.insert(deltas.end(), org_deltas, org_deltas + num_deltas);
+    nodes[id].num_deltas = (uint32_t)num_deltas;
+    nodes[parent].refs++;
+    return id;
+  }
+
+  void AddRef(size_t id)
+  {
+    emp_assert(id < nodes.size(), id);
+    nodes[id].refs++;
+  }
+
+  // drops a reference, freeing the node and then any ancestors left without one
+  void Release(size_t id)
+  {
+    while (id != NO_PARENT)
+    {
+      emp_assert(id < nodes.size() && nodes[id].refs, id);
+      Node &node = nodes[id];
+      if (--node.refs)
+        return;
+      if (node.parent == NO_PARENT)
+        roots.erase(id);
+      dead_deltas += node.num_deltas;
+      node.num_deltas = 0;
+      free_nodes.push_back(id);
+      id = node.parent;
+    }
+  }
+
+  size_t GetNumNodes() const { return nodes.size() - free_nodes.size(); }
+  size_t GetNumDeltas() const { return deltas.size() - dead_deltas; }
+  size_t GetParent(size_t id) const { return nodes[id].parent; }
+  size_t GetUpdate(size_t id) const { return nodes[id].update; }
+  size_t GetNumDeltas(size_t id) const { return nodes[id].num_deltas; }
+  const Delta *GetDeltas(size_t id) const { return deltas.data() + nodes[id].first_delta; }
+  const RootGenome &GetRoot(size_t id) const { return roots.at(id); }
+
+  // nodes from the root down to id
+  emp::vector<size_t> GetAncestry(size_t id) const
+  {
+    emp::vector<size_t> ancestry;
+    for (; id != NO_PARENT; id = nodes[id].parent)
+      ancestry.push_back(id);
+    return emp::vector<size_t>(ancestry.rbegin(), ancestry.rend());
+  }
+
+  // writes the line of descent of id as csv, one row per node from the root
+  // down. The root row has the starting genome and gene starts, every other row
+  // the mutations that led to it: m<gene>:<start> for a gene move, f<bit> for a
+  // flip, i<bit>:<value> for an insertion and d<bit> for a deletion
+  void WriteAncestry(std::ostream &out, size_t id) const
+  {
+    out << "update,genome,gene_starts,mutations\n";
+    for (size_t node_id : GetAncestry(id))
+    {
+      const Node &node = nodes[node_id];
+      out << node.update << ",";
+      if (node.parent == NO_PARENT)
+      {
+        const RootGenome &root = GetRoot(node_id);
+        for (size_t i = 0; i < root.num_bits; i++)
+          out << ((root.words[i / 32] >> (i % 32)) & 1);
+        out << ",";
+        for (size_t i = 0; i < root.gene_starts.size(); i++)
+          out << (i ? " " : "") << root.gene_starts[i];
+      }
+      else
+        out << ",";
+      out << ",";
+      const Delta *node_deltas = GetDeltas(node_id);
+      for (size_t i = 0; i < node.num_deltas; i++)
+      {
+        const Delta &delta = node_deltas[i];
+        out << (i ? " " : "");
+        switch (delta.type)
+        {
+        case GENE_MOVE: out << "m" << delta.a << ":" << delta.b; break;
+        case BIT_FLIP: out << "f" << delta.a; break;
+        case BIT_INSERT: out << "i" << delta.a << ":" << delta.b; break;
+        case BIT_DELETE: out << "d" << delta.a; break;
+        }
+      }
+      out << "\n";
+    }
+  }
+
+  // appends the whole tree to a checkpoint, freed nodes and dead deltas
+  // included, so a restored tree numbers and compacts nodes as this one would:
+  //
+  //   uint32   num nodes, then per node
+  //     uint64   parent, update and first delta
+  //     uint32   num deltas and refs
+  //   uint32   num free nodes, then uint32 each
+  //   uint64   dead deltas
+  //   uint32   num deltas, then per delta uint32 a and b and uint8 type
+  //   uint32   num roots, then per root, in node order
+  //     uint32   node, genome size, packed genome words, num gene starts, gene starts
+  void Save(emp::vector<unsigned char> &data) const
+  {
+    AagosSnapshot::PutUInt(data, nodes.size(), 4);
+    for (const Node &node : nodes)
+    {
+      AagosSnapshot::PutUInt(data, node.parent, 8);
+      AagosSnapshot::PutUInt(data, node.update, 8);
+      AagosSnapshot::PutUInt(data, node.first_delta, 8);
+      AagosSnapshot::PutUInt(data, node.num_deltas, 4);
+      AagosSnapshot::PutUInt(data, node.refs, 4);
+    }
+    AagosSnapshot::PutUInt(data, free_nodes.size(), 4);
+    for (size_t id : free_nodes)
+      AagosSnapshot::PutUInt(data, id, 4);
+    AagosSnapshot::PutUInt(data, dead_deltas, 8);
+    AagosSnapshot::PutUInt(data, deltas.size(), 4);
+    for (const Delta &delta : deltas)
+    {
+      AagosSnapshot::PutUInt(data, delta.a, 4);
+      AagosSnapshot::PutUInt(data, delta.b, 4);
+      AagosSnapshot::PutUInt(data, delta.type, 1);
+    }
+    emp::vector<size_t> root_ids;
+    for (const auto &root : roots)
+      root_ids.push_back(root.first);
+    std::sort(root_ids.begin(), root_ids.end());
+    AagosSnapshot::PutUInt(data, root_ids.size(), 4);
+    for (size_t id : root_ids)
+    {
+      const RootGenome &root = roots.at(id);
+      AagosSnapshot::PutUInt(data, id, 4);
+      AagosSnapshot::PutUInt(data, root.num_bits, 4);
+      for (uint32_t word : root.words)
+        AagosSnapshot::PutUInt(data, word, 4);
+      AagosSnapshot::PutUInt(data, root.gene_starts.size(), 4);
+      for (size_t start : root.gene_starts)
+        AagosSnapshot::PutUInt(data, start, 4);
+    }
+  }
+
+  // replaces this tree with one written by Save. Returns false if it can't be read
+  bool Load(AagosCheckpoint::Cursor &in)
+  {
+    nodes.resize(in.GetUInt(4));
+    for (Node &node : nodes)
+    {
+      node.parent = in.GetUInt(8);
+      node.update = in.GetUInt(8);
+      node.first_delta = in.GetUInt(8);
+      node.num_deltas = (uint32_t)in.GetUInt(4);
+      node.refs = (uint32_t)in.GetUInt(4);
+      if (!in.IsOk())
+        return false;
+    }
+    free_nodes.resize(in.GetUInt(4));
+    for (size_t &id : free_nodes)
+    {
+      id = in.GetUInt(4);
+      if (!in.IsOk() || id >= nodes.size())
+        return false;
+    }
+    dead_deltas = in.GetUInt(8);
+    deltas.resize(in.GetUInt(4));
+    for (Delta &delta : deltas)
+    {
+      delta.a = (uint32_t)in.GetUInt(4);
+      delta.b = (uint32_t)in.GetUInt(4);
+      delta.type = (DeltaType)in.GetUInt(1);
+      if (!in.IsOk() || delta.type > BIT_DELETE)
+        return false;
+    }
+    for (const Node &node : nodes)
+    {
+      if ((node.parent != NO_PARENT && node.parent >= nodes.size()) || node.first_delta + node.num_deltas > deltas.size())
+        return false;
+    }
+    roots.clear();
+    const size_t num_roots = in.GetUInt(4);
+    for (size_t i = 0; i < num_roots && in.IsOk(); i++)
+    {
+      const size_t id = in.GetUInt(4);
+      RootGenome &root = roots[id];
+      root.num_bits = in.GetUInt(4);
+      root.words.resize((root.num_bits + 31) / 32);
+      for (uint32_t &word : root.words)
+        word = (uint32_t)in.GetUInt(4);
+      root.gene_starts.resize(in.GetUInt(4));
+      for (size_t &start : root.gene_starts)
+        start = in.GetUInt(4);
+      if (id >= nodes.size() || nodes[id].parent != NO_PARENT)
+        return false;
+    }
+    return in.IsOk();
+  }
+
+  // deltas recorded by mutations on the calling thread, cleared by whoever reads them
+  static emp::vector<Delta> &ThreadLog()
+  {
+    static thread_local emp::vector<Delta> log;
+    return log;
+  }
+};
+
+#endif
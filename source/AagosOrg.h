@@ -1,44 +1,83 @@
 #ifndef AAGOS_ORG_H
 #define AAGOS_ORG_H
 
+#include <algorithm>
+#include <memory>
+
 #include "tools/BitVector.h"
 #include "tools/Random.h"
 #include "tools/random_utils.h"
 #include "tools/string_utils.h"
-#include "data/DataNode.h"
+
+#include "AagosCoverage.h"
+#include "AagosGenome.h"
+#include "CowPtr.h"
 
 class AagosOrg
 {
   friend class AagosWorld;
 
+public:
+  // most environments a world can cycle between, each with its own cached fitness
+  static constexpr size_t MAX_ENVIRONMENTS = 8;
+
 private:
+  // histogram and neighbor data, recalculated by StatsCalc
+  struct Stats
+  {
+    // number of neighbors each gene in genome has
+    // neighbor is defined as a gene that overlaps the current gene
+    // at at least one bit
+    emp::vector<int> gene_neighbors;
+    // number of genes overlapping each bit in genome
+    emp::vector<int> site_coverage;
+    // histogram of site_coverage, bin i is the number of bits with i genes on them
+    emp::vector<size_t> hist_counts;
+  };
+
+  // Genome, gene starts and stats are all shared with copies of the org until
+  // one of them changes, so offspring that come through mutation unchanged
+  // never copy any of them and keep the parent's stats and fitness
   // genome of organism - bitstring
-  emp::BitVector bits;
+  AagosGenome bits;
   // starting locations of all genes
-  emp::vector<size_t> gene_starts;
+  CowPtr<emp::vector<size_t>> gene_starts;
   // size of each gene in genome
   size_t gene_size;
   // number of genes in genome
   size_t num_genes;
   size_t num_bins;
-  // number of neighbors each gene in genome has
-  // neighbor is defined as a gene that overlaps the current gene
-  // at at least one bit
-  emp::vector<int> gene_neighbors;
-  // Histogram object that stores num overlapped genes at each bit in genome
-  emp::DataNode<int, emp::data::Histogram, emp::data::Stats> histogram;
+  CowPtr<Stats> stats;
   // bool flag to check if histogram has been initialized yet
+  // once set, gene moves keep the histogram and neighbors up to date in place
   bool initialized;
+  // fitness cached by the world in each of its environments, only valid while
+  // fitness_epoch matches that environment's epoch. Epoch 0 means fitness
+  // hasn't been calculated
+  double fitness[MAX_ENVIRONMENTS];
+  size_t fitness_epoch[MAX_ENVIRONMENTS];
+  // each gene's share of the fitness cached for environment gene_fitness_env,
+  // kept so the world can rescore only the genes an environment change touched.
+  // Empty unless the environment changes
+  CowPtr<emp::vector<double>> gene_fitness;
+  size_t gene_fitness_env;
 
 public:
-  AagosOrg(size_t num_bits = 64, size_t num_genes = 64, size_t in_gene_size = 8)
-      : bits(num_bits)
-      , gene_starts(num_genes, 0)
+  // orgs given a genome pool keep their genome, and the genomes of all their
+  // copies, in slots of that pool
+  AagosOrg(size_t num_bits = 64, size_t num_genes = 64, size_t in_gene_size = 8,
+           std::shared_ptr<AagosGenomePool> genome_pool = nullptr)
+      : bits(num_bits, genome_pool)
+      , gene_starts(emp::vector<size_t>(num_genes, 0))
       , gene_size(in_gene_size)
       , num_genes(num_genes)
       , num_bins(num_genes + 1)
-      , gene_neighbors(num_genes)
+      , stats(Stats{emp::vector<int>(num_genes), emp::vector<int>(), emp::vector<size_t>(num_bins, 0)})
       , initialized(false)
+      , fitness()
+      , fitness_epoch()
+      , gene_fitness()
+      , gene_fitness_env(0)
   {
     emp_assert(num_bits > 0, num_bits);
     emp_assert(num_genes > 0, num_genes);
@@ -58,58 +97,256 @@ public:
   // getter function for size of organism genome
   size_t GetNumBits() const { return bits.size(); }
   // getter function for number of genes
-  size_t GetNumGenes() const { return gene_starts.size(); }
+  size_t GetNumGenes() const { return gene_starts.Get().size(); }
   // getter for organism genome
-  const emp::BitVector &GetBits() const { return bits; }
+  const AagosGenome &GetBits() const { return bits; }
   // getter for gene start locations
-  const emp::vector<size_t> &GetGeneStarts() const { return gene_starts; }
+  const emp::vector<size_t> &GetGeneStarts() const { return gene_starts.Get(); }
+  // value of gene gene_id under mask (mask of the low gene_size bits), first bit
+  // lowest. Genes running off the end of the genome continue at its front, for
+  // whatever length the genome has now. Two word loads per gene, at any position
+  uint32_t GetGeneValue(size_t gene_id, uint32_t mask) const
+  {
+    const size_t start = gene_starts.Get()[gene_id];
+    emp_assert(gene_size <= 32 && start < GetNumBits(), gene_size, start);
+    return bits.GetUIntAtBit(start) & mask;
+  }
   // getter for number of bins in histogram
   const size_t GetNumBins() { return num_bins; }
 
   void ResetHistogram() {
-    histogram.Reset();
     initialized = false;
   }
 
+  // marks cached fitness as stale, must be called whenever genome or genes change
+  void ResetFitness() {
+    for (size_t &epoch : fitness_epoch)
+      epoch = 0;
+  }
+
+  // moves a gene to a new start location. If the histogram and neighbors are
+  // already calculated, only the bits and genes touched by the move are updated
+  void MoveGene(size_t gene_id, size_t new_start)
+  {
+    const size_t old_start = gene_starts.Get()[gene_id];
+    if (old_start == new_start)
+      return;
+    emp::vector<size_t> &starts = gene_starts.Mutable();
+    if (initialized)
+    {
+      Stats &org_stats = stats.Mutable();
+      const int num_bits = (int)GetNumBits();
+      AddCoverage(org_stats, old_start, -1);
+      AddCoverage(org_stats, new_start, 1);
+      // neighbor relation is symmetric, so only pairs with the moved gene change
+      int count = 0;
+      for (size_t j = 0; j < num_genes; j++)
+      {
+        if (j == gene_id)
+          continue;
+        if (IsNeighbor(old_start, starts[j], num_bits))
+          org_stats.gene_neighbors[j]--;
+        if (IsNeighbor(new_start, starts[j], num_bits))
+        {
+          org_stats.gene_neighbors[j]++;
+          count++;
+        }
+      }
+      org_stats.gene_neighbors[gene_id] = count;
+    }
+    starts[gene_id] = new_start;
+  }
+
   // randomizes genome and gene starts
   void Randomize(emp::Random &random)
   {
-    emp::RandomizeBitVector(bits, random);
-    emp::RandomizeVector<size_t>(gene_starts, random, 0, bits.size());
+    bits.Randomize(random);
+    emp::RandomizeVector<size_t>(gene_starts.Mutable(), random, 0, bits.size());
+    ResetHistogram();
+    ResetFitness();
+  }
+
+  // Applies a batch of bit insertions followed by a batch of bit deletions.
+  // Positions are given in the order they were drawn, each relative to the
+  // genome as it stood after the previous event, so the result is the same as
+  // doing each indel one at a time. The genome is rebuilt in a single
+  // word-wise pass and gene starts are remapped once at the end.
+  void DoIndels(const emp::vector<size_t> &insert_pos, const emp::vector<bool> &insert_vals,
+                const emp::vector<size_t> &delete_pos)
+  {
+    emp_assert(insert_pos.size() == insert_vals.size());
+    if (insert_pos.empty() && delete_pos.empty())
+      return;
+
+    // move insertions into post-insertion coordinates, kept sorted. A later
+    // insertion pushes earlier inserted bits at or after its position up by one
+    emp::vector<size_t> ins_sites;
+    emp::vector<bool> ins_vals;
+    for (size_t i = 0; i < insert_pos.size(); i++)
+    {
+      size_t slot = ins_sites.size();
+      for (size_t j = 0; j < ins_sites.size(); j++)
+      {
+        if (ins_sites[j] >= insert_pos[i])
+        {
+          if (slot == ins_sites.size())
+            slot = j;
+          ins_sites[j]++;
+        }
+      }
+      ins_sites.insert(ins_sites.begin() + (int)slot, insert_pos[i]);
+      ins_vals.insert(ins_vals.begin() + (int)slot, insert_vals[i]);
+    }
+
+    // move deletions into post-insertion coordinates, kept sorted. Each position
+    // counts only the sites that survived the deletions drawn before it
+    emp::vector<size_t> del_sites;
+    for (size_t pos : delete_pos)
+    {
+      size_t site = pos;
+      size_t slot = 0;
+      while (slot < del_sites.size() && del_sites[slot] <= site)
+      {
+        site++;
+        slot++;
+      }
+      del_sites.insert(del_sites.begin() + (int)slot, site);
+    }
+
+    // rebuild genome, copying runs of untouched bits a word at a time
+    const size_t mid_size = bits.size() + ins_sites.size();
+    const size_t new_size = mid_size - del_sites.size();
+    emp::vector<uint32_t> new_words((new_size + 31) / 32, 0);
+    uint64_t out_buffer = 0; // bits waiting to be written to new genome
+    size_t out_count = 0;    // number of bits in out_buffer
+    size_t out_word = 0;     // next 32-bit word of new genome to write
+    auto push_bits = [&new_words, &out_buffer, &out_count, &out_word](uint32_t val, size_t count) {
+      out_buffer |= (uint64_t)val << out_count;
+      out_count += count;
+      if (out_count >= 32)
+      {
+        new_words[out_word++] = (uint32_t)out_buffer;
+        out_buffer >>= 32;
+        out_count -= 32;
+      }
+    };
+
+    size_t src = 0; // next bit of old genome to copy
+    size_t mid = 0; // current post-insertion position
+    size_t next_ins = 0, next_del = 0;
+    while (mid < mid_size)
+    {
+      const size_t ins_site = next_ins < ins_sites.size() ? ins_sites[next_ins] : mid_size;
+      const size_t del_site = next_del < del_sites.size() ? del_sites[next_del] : mid_size;
+      const size_t event_site = std::min(ins_site, del_site);
+      // copy run of old bits up to the next event
+      for (size_t run = event_site - mid; run > 0;)
+      {
+        const size_t count = std::min(run, (size_t)32);
+        push_bits(bits.GetUIntAtBit(src) & emp::MaskLow<uint32_t>(count), count);
+        src += count;
+        run -= count;
+      }
+      mid = event_site;
+      if (mid == mid_size)
+        break;
+      if (ins_site == mid)
+      { // inserted bit, kept unless it was later deleted
+        if (del_site != mid)
+          push_bits(ins_vals[next_ins], 1);
+        next_ins++;
+      }
+      else
+      { // old bit that was deleted
+        src++;
+      }
+      if (del_site == mid)
+        next_del++;
+      mid++;
+    }
+    if (out_count > 0)
+      new_words[out_word] = (uint32_t)out_buffer;
+    bits.Assign(new_words, new_size); // stays in the same pool slot
+    ResetHistogram(); // every gene may have shifted relative to the genome end
+
+    // genes follow the bit they started on. If that bit was deleted the gene
+    // falls back to the previous surviving bit, or stays at the front.
+    for (auto &start : gene_starts.Mutable())
+    {
+      size_t site = start;
+      for (size_t ins_site : ins_sites)
+      {
+        if (ins_site > site)
+          break;
+        site++;
+      }
+      const auto del_it = std::lower_bound(del_sites.begin(), del_sites.end(), site);
+      start = site - (size_t)(del_it - del_sites.begin());
+      if (del_it != del_sites.end() && *del_it == site && start > 0)
+        start--;
+    }
   }
 
   // print override for aagos organism
   void Print(std::ostream &is = std::cout) const
   {
     is << "Bits: " << bits << '\n';
-    is << "Gene Starts: " << emp::to_string(gene_starts) << std::endl;
+    is << "Gene Starts: " << emp::to_string(gene_starts.Get()) << std::endl;
   }
 
   // getter function for gene neighbors
-  emp::vector<int> &GetGeneNeighbors()
+  const emp::vector<int> &GetGeneNeighbors()
+  {
+    // if the histogram hasn't been set up, calculate
+    if (!initialized)
+      StatsCalc();
+    return stats.Get().gene_neighbors;
+  }
+
+  // getter function for number of bits with given number of overlapping genes
+  size_t GetHistCount(size_t bin)
   {
     // if the histogram hasn't been set up, calculate
     if (!initialized)
       StatsCalc();
-    return gene_neighbors;
+    return stats.Get().hist_counts[bin];
   }
 
-  // getter function for gene overlap histogram
-  emp::DataNode<int, emp::data::Histogram, emp::data::Stats> &GetHistogram()
+  // getter function for gene overlap histogram bins
+  const emp::vector<size_t> &GetHistCounts()
   {
     // if the histogram hasn't been set up, calculate
     if (!initialized)
       StatsCalc();
-    return histogram;
+    return stats.Get().hist_counts;
+  }
+
+  // getter function for average number of genes per bit (mean of histogram)
+  double GetAvgOverlap() const
+  {
+    // every gene covers exactly gene_size bits, so no need to build histogram
+    return (double)(num_genes * gene_size) / (double)GetNumBits();
+  }
+
+  // number of times StatsCalc has run on the calling thread, for perf counters
+  static size_t &NumStatsCalcs()
+  {
+    static thread_local size_t count = 0;
+    return count;
   }
 
   // calculates histogram and gene neighbors for the current organism
   // only called when a snapshot or statistics need to be taken for a pop
-  // b/c GetHistogram and GetNeighbors only called when snapshot and stats calc
+  // b/c GetHistCounts and GetGeneNeighbors only called when snapshot and stats calc
   void StatsCalc()
   {
     // set sentinel
     initialized = true;
+    NumStatsCalcs()++;
+    // stats still shared with a copy are about to be replaced, so start fresh
+    // rather than copying them first
+    if (stats.IsShared())
+      stats = CowPtr<Stats>(Stats());
     size_t num_bits = GetNumBits();
     // set up histogram
     HistogramCalc((int)num_bits);
@@ -124,40 +361,38 @@ public:
   // Taks the size of the genome as an argument
   void HistogramCalc(int num_bits)
   {
-
     // histogram bins ranges from 0 (no overlap) to num_genes, b/c worst case all
     // genes overlap the same bit. Num bins is then num_genes + 1 b/c need a
     // bin for no overlap.
-    histogram.SetupBins(0, (int)num_bins, num_bins);
+    Stats &org_stats = stats.Mutable();
+    emp::vector<size_t> &hist_counts = org_stats.hist_counts;
+    emp::vector<int> &site_coverage = org_stats.site_coverage;
+    const emp::vector<size_t> &starts = gene_starts.Get();
+    hist_counts.assign(num_bins, 0);
 
-    // adds the number of genes associated with each bit to histogram data node
-    // first loops through each bit
-    for (int i = 0; i < (int) bits.size(); i++)
+    // mark where each gene starts and stops covering bits in a difference array,
+    // so the overlap at every bit comes from one prefix sum over the genome
+    // instead of checking each gene at each bit
+    site_coverage.assign((size_t)num_bits + 1, 0); // extra entry for genes ending on the last bit
+    for (size_t j = 0; j < num_genes; j++)
     {
-      // counts number of genes that overlap at given bit
-      int overlap = 0;
-      // max range that a gene can start in order to overlap current bit
-      int diff = i - ((int)gene_size - 1);// off by one error
-
-      // loops through each gene to see if it overlaps current bit
-      for (size_t j = 0; j < num_genes; j++)
+      const int start = (int)starts[j];
+      const int end = start + (int)gene_size;
+      site_coverage[(size_t)start]++;
+      if (end <= num_bits)
       {
-        // if current gene starts within diff of the current bit
-        // and also if the current gene starts before the current bit
-        // then the curr gene must overlap the curr bit
-        if ((diff <= (int) gene_starts[j] && (int) gene_starts[j] <= i)
-            // else if curr gene loops around to front of genome,
-            // then if it loops around enough to overlap current bit
-            // then diff will be more negative than the
-            //  gene start - the number of bits in genome
-            || ((diff <= ((int) gene_starts[j] - num_bits)))) 
-        {
-          overlap++;
-        }
+        site_coverage[(size_t)end]--;
+      }
+      else // gene loops around to front of genome
+      {
+        site_coverage[0]++;
+        site_coverage[(size_t)(end - num_bits)]--;
       }
-      // once total overlap for given bit is calc, add to hist.
-      histogram.Add(overlap);
     }
+    site_coverage.resize((size_t)num_bits);
+
+    AagosCoverage::PrefixSum(site_coverage.data(), site_coverage.size());
+    AagosCoverage::CountBins(site_coverage.data(), site_coverage.size(), hist_counts.data(), num_bins);
   }
 
   // calculates all neighboring genes for each gene in genome.
@@ -166,6 +401,9 @@ public:
   // takes the size of the genome as its argument
   void NeighborCalc(int num_bits)
   {
+    emp::vector<int> &gene_neighbors = stats.Mutable().gene_neighbors;
+    const emp::vector<size_t> &starts = gene_starts.Get();
+    gene_neighbors.resize(num_genes);
     // loops through each gene to get its neighbor count
     for (size_t i = 0; i < num_genes; i++)
     {
@@ -176,10 +414,7 @@ public:
         // clearly, the curr gene should not count towards its own neighbor count
         if (i != j)
         {
-          // if the current gene starts w/in gene_size on either side of gene in question, must overlap
-          if (abs((int)gene_starts[i] - (int)gene_starts[j]) < gene_size || // todo clean up these casts
-              // this second check catches genes that overlap only by comparing the ends of both genes to each other modded
-              abs(((int)gene_starts[i] + (int)gene_size) % (int)num_bits - ((int)gene_starts[j] + (int)gene_size) % (int)num_bits) < (int)gene_size)
+          if (IsNeighbor(starts[i], starts[j], num_bits))
           {
             count++;
           }
@@ -189,5 +424,32 @@ public:
       gene_neighbors[i] = count;
     }
   }
+
+private:
+  // checks whether genes starting at the two given locations share at least one bit
+  bool IsNeighbor(size_t start_a, size_t start_b, int num_bits) const
+  {
+    // if the current gene starts w/in gene_size on either side of gene in question, must overlap
+    return abs((int)start_a - (int)start_b) < gene_size || // todo clean up these casts
+           // this second check catches genes that overlap only by comparing the ends of both genes to each other modded
+           abs(((int)start_a + (int)gene_size) % num_bits - ((int)start_b + (int)gene_size) % num_bits) < (int)gene_size;
+  }
+
+  // adds delta to the overlap of every bit covered by a gene starting at start,
+  // moving those bits between histogram bins
+  void AddCoverage(Stats &org_stats, size_t start, int delta)
+  {
+    const size_t num_bits = GetNumBits();
+    size_t site = start;
+    for (size_t i = 0; i < gene_size; i++)
+    {
+      int &overlap = org_stats.site_coverage[site];
+      org_stats.hist_counts[(size_t)overlap]--;
+      overlap += delta;
+      org_stats.hist_counts[(size_t)overlap]++;
+      if (++site == num_bits) // gene loops around to front of genome
+        site = 0;
+    }
+  }
 };
 #endif
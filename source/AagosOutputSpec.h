@@ -0,0 +1,49 @@
+#ifndef AAGOS_OUTPUT_SPEC_H
+#define AAGOS_OUTPUT_SPEC_H
+
+#include <string>
+
+#include "base/vector.h"
+
+// Which columns to write to output.csv, and on which updates. Rows are written
+// for updates first_update, first_update + every, ... up to last_update
+struct AagosOutputSpec
+{
+  emp::vector<std::string> columns;
+  size_t first_update;
+  size_t last_update;
+  size_t every;
+
+  // columns is a comma separated list of names, spaces around names are ignored.
+  // A last_update of 0 means no last update
+  AagosOutputSpec(const std::string &column_list = "", size_t _first_update = 0, size_t _last_update = 0,
+                  size_t _every = 1)
+      : columns()
+      , first_update(_first_update)
+      , last_update(_last_update ? _last_update : (size_t)-1)
+      , every(_every ? _every : 1)
+  {
+    std::string name;
+    for (size_t i = 0; i <= column_list.size(); i++)
+    {
+      const char c = i < column_list.size() ? column_list[i] : ',';
+      if (c == ',')
+      {
+        if (name.size())
+          columns.push_back(name);
+        name.clear();
+      }
+      else if (c != ' ' && c != '\t')
+        name.push_back(c);
+    }
+  }
+
+  bool IsEnabled() const { return columns.size() > 0; }
+
+  bool IsOutputUpdate(size_t update) const
+  {
+    return update >= first_update && update <= last_update && (update - first_update) % every == 0;
+  }
+};
+
+#endif
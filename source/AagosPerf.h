@@ -0,0 +1,115 @@
+#ifndef AAGOS_PERF_H
+#define AAGOS_PERF_H
+
+#include <atomic>
+#include <chrono>
+#include <ostream>
+
+// Wall time spent in each phase of a generation and counts of the work done,
+// accumulated between rows of perf.csv. Counters bumped from worker threads
+// are atomic; everything else is only touched by the thread running the world
+class AagosPerf
+{
+public:
+  enum Phase
+  {
+    MUTATION,
+    FITNESS,
+    SELECTION,
+    ENVIRONMENT,
+    OUTPUT,
+    NUM_PHASES
+  };
+
+  // adds the wall time from its construction to its destruction to a phase.
+  // Does nothing when given no AagosPerf, so timing costs nothing when disabled
+  class PhaseTimer
+  {
+  private:
+    using clock_t = std::chrono::steady_clock;
+    AagosPerf *perf;
+    Phase phase;
+    clock_t::time_point start;
+
+  public:
+    PhaseTimer(AagosPerf *_perf, Phase _phase)
+        : perf(_perf)
+        , phase(_phase)
+        , start(_perf ? clock_t::now() : clock_t::time_point())
+    {
+    }
+
+    PhaseTimer(PhaseTimer &&other)
+        : perf(other.perf)
+        , phase(other.phase)
+        , start(other.start)
+    {
+      other.perf = nullptr;
+    }
+
+    PhaseTimer(const PhaseTimer &) = delete;
+    PhaseTimer &operator=(const PhaseTimer &) = delete;
+
+    ~PhaseTimer()
+    {
+      if (perf)
+        perf->phase_seconds[phase] += std::chrono::duration<double>(clock_t::now() - start).count();
+    }
+  };
+
+  double phase_seconds[NUM_PHASES];
+  size_t num_updates;
+  std::atomic<size_t> gene_moves;
+  std::atomic<size_t> bit_flips;
+  std::atomic<size_t> bit_inserts;
+  std::atomic<size_t> bit_deletes;
+  std::atomic<size_t> fitness_evals;
+  size_t stats_calcs;
+
+  AagosPerf() { Reset(); }
+
+  AagosPerf(const AagosPerf &) = delete;
+  AagosPerf &operator=(const AagosPerf &) = delete;
+
+  void Reset()
+  {
+    for (double &seconds : phase_seconds)
+      seconds = 0.0;
+    num_updates = 0;
+    gene_moves = 0;
+    bit_flips = 0;
+    bit_inserts = 0;
+    bit_deletes = 0;
+    fitness_evals = 0;
+    stats_calcs = 0;
+  }
+
+  void CountMutations(size_t moves, size_t flips, size_t inserts, size_t deletes)
+  {
+    gene_moves.fetch_add(moves, std::memory_order_relaxed);
+    bit_flips.fetch_add(flips, std::memory_order_relaxed);
+    bit_inserts.fetch_add(inserts, std::memory_order_relaxed);
+    bit_deletes.fetch_add(deletes, std::memory_order_relaxed);
+  }
+
+  void CountFitnessEval() { fitness_evals.fetch_add(1, std::memory_order_relaxed); }
+
+  static void WriteHeader(std::ostream &out)
+  {
+    out << "update,num_updates,mutation_sec,fitness_sec,selection_sec,environment_sec,output_sec,"
+        << "gene_moves,bit_flips,bit_inserts,bit_deletes,fitness_evals,stats_calcs,data_bytes" << std::endl;
+  }
+
+  // writes everything counted since the last row, then starts counting again
+  void WriteRow(std::ostream &out, size_t update, size_t data_bytes)
+  {
+    out << update << ',' << num_updates;
+    for (double seconds : phase_seconds)
+      out << ',' << seconds;
+    out << ',' << gene_moves << ',' << bit_flips << ',' << bit_inserts << ',' << bit_deletes << ','
+        << fitness_evals << ',' << stats_calcs << ',' << data_bytes << std::endl;
+    Reset();
+  }
+};
+
+#endif
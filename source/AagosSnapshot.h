@@ -0,0 +1,339 @@
+#ifndef AAGOS_SNAPSHOT_H
+#define AAGOS_SNAPSHOT_H
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <unistd.h>
+
+#include "base/Ptr.h"
+#include "base/vector.h"
+#include "tools/BitVector.h"
+#include "tools/stats.h"
+
+#include "AagosOrg.h"
+#include "AsyncWriter.h"
+
+// Binary snapshot format, all values little endian:
+//
+// file header
+//   char[8]  magic "AAGOSSNP"
+//   uint32   format version
+//   uint32   num genes, gene size, num histogram bins
+// then one block per snapshot update
+//   uint64   update
+//   uint32   num orgs
+//   uint64   payload bytes, so readers can skip to the next update
+//   payload, one column at a time:
+//     float64  fitness of each org
+//     float64  mean gene neighbors of each org
+//     uint32   genome size of each org
+//     uint32   packed genome words of each org, ceil(genome size / 32) per org
+//     varint   gene starts of each org, num genes per org
+//     varint   histogram bins of each org, num bins per org
+namespace AagosSnapshot
+{
+  constexpr char MAGIC[8] = {'A', 'A', 'G', 'O', 'S', 'S', 'N', 'P'};
+  constexpr uint32_t VERSION = 1;
+  constexpr size_t FILE_HEADER_BYTES = 8 + 4 * 4;
+  constexpr size_t BLOCK_HEADER_BYTES = 8 + 4 + 8;
+
+  // number of 32-bit words needed to store a genome of given size
+  inline size_t NumWords(size_t num_bits) { return (num_bits + 31) / 32; }
+
+  inline void PutUInt(emp::vector<unsigned char> &out, uint64_t val, size_t num_bytes)
+  {
+    for (size_t i = 0; i < num_bytes; i++)
+      out.push_back((unsigned char)(val >> (8 * i)));
+  }
+
+  inline void PutDouble(emp::vector<unsigned char> &out, double val)
+  {
+    uint64_t raw;
+    std::memcpy(&raw, &val, sizeof(raw));
+    PutUInt(out, raw, 8);
+  }
+
+  // unsigned LEB128, 7 bits per byte with high bit set on all but the last byte
+  inline void PutVarint(emp::vector<unsigned char> &out, uint64_t val)
+  {
+    while (val >= 0x80)
+    {
+      out.push_back((unsigned char)(val | 0x80));
+      val >>= 7;
+    }
+    out.push_back((unsigned char)val);
+  }
+
+  inline uint64_t GetUInt(const unsigned char *in, size_t num_bytes)
+  {
+    uint64_t val = 0;
+    for (size_t i = 0; i < num_bytes; i++)
+      val |= (uint64_t)in[i] << (8 * i);
+    return val;
+  }
+
+  inline double GetDouble(const unsigned char *in)
+  {
+    const uint64_t raw = GetUInt(in, 8);
+    double val;
+    std::memcpy(&val, &raw, sizeof(val));
+    return val;
+  }
+
+  // reads varint at pos and moves pos past it
+  inline uint64_t GetVarint(const emp::vector<unsigned char> &in, size_t &pos)
+  {
+    uint64_t val = 0;
+    for (size_t shift = 0; pos < in.size(); shift += 7)
+    {
+      const unsigned char byte = in[pos++];
+      val |= (uint64_t)(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        break;
+    }
+    return val;
+  }
+}
+
+// writes population snapshots to a binary snapshot file
+class AagosSnapshotWriter
+{
+private:
+  std::ofstream file;
+  std::unique_ptr<AsyncOStream> async_file; // only used when writing through an AsyncWriter
+  std::ostream *out;                        // whichever of the two is in use
+  size_t num_genes;
+  size_t num_bins;
+  // total bytes in file, so a checkpoint can record where to resume writing
+  size_t bytes_written;
+  // block being built, kept between snapshots to reuse its memory
+  emp::vector<unsigned char> block;
+
+public:
+  // resume_bytes > 0 continues an existing file, dropping anything written
+  // after the first resume_bytes bytes. Starts a new file if there is none to continue.
+  // Blocks are handed to async_writer to write when one is given
+  AagosSnapshotWriter(const std::string &filename, size_t _num_genes, size_t gene_size, size_t _num_bins,
+                      size_t resume_bytes = 0, AsyncWriter *async_writer = nullptr)
+      : file()
+      , async_file()
+      , out(&file)
+      , num_genes(_num_genes)
+      , num_bins(_num_bins)
+      , bytes_written(resume_bytes)
+      , block()
+  {
+    const bool resume = resume_bytes > 0 && truncate(filename.c_str(), (off_t)resume_bytes) == 0;
+    const std::ios::openmode mode = resume ? std::ios::binary | std::ios::app : std::ios::binary;
+    if (async_writer)
+    {
+      async_file.reset(new AsyncOStream(*async_writer, filename, mode));
+      out = async_file.get();
+    }
+    else
+      file.open(filename, mode);
+    if (resume)
+      return;
+    emp::vector<unsigned char> header(AagosSnapshot::MAGIC, AagosSnapshot::MAGIC + 8);
+    AagosSnapshot::PutUInt(header, AagosSnapshot::VERSION, 4);
+    AagosSnapshot::PutUInt(header, num_genes, 4);
+    AagosSnapshot::PutUInt(header, gene_size, 4);
+    AagosSnapshot::PutUInt(header, num_bins, 4);
+    out->write((const char *)header.data(), (std::streamsize)header.size());
+    bytes_written = header.size();
+  }
+
+  size_t GetBytesWritten() const { return bytes_written; }
+
+  // appends one block holding every given org, with fitness[i] belonging to orgs[i]
+  void Write(size_t update, const emp::vector<emp::Ptr<AagosOrg>> &orgs, const emp::vector<double> &fitness)
+  {
+    emp_assert(orgs.size() == fitness.size());
+    block.resize(0);
+    AagosSnapshot::PutUInt(block, update, 8);
+    AagosSnapshot::PutUInt(block, orgs.size(), 4);
+    AagosSnapshot::PutUInt(block, 0, 8); // payload size, filled in below
+
+    for (double fit : fitness)
+      AagosSnapshot::PutDouble(block, fit);
+    for (emp::Ptr<AagosOrg> org : orgs)
+      AagosSnapshot::PutDouble(block, emp::Mean(org->GetGeneNeighbors()));
+    for (emp::Ptr<AagosOrg> org : orgs)
+      AagosSnapshot::PutUInt(block, org->GetNumBits(), 4);
+    for (emp::Ptr<AagosOrg> org : orgs)
+    {
+      const AagosGenome &bits = org->GetBits();
+      for (size_t w = 0; w < AagosSnapshot::NumWords(bits.size()); w++)
+        AagosSnapshot::PutUInt(block, bits.GetUInt(w), 4);
+    }
+    for (emp::Ptr<AagosOrg> org : orgs)
+    {
+      emp_assert(org->GetNumGenes() == num_genes);
+      for (size_t start : org->GetGeneStarts())
+        AagosSnapshot::PutVarint(block, start);
+    }
+    for (emp::Ptr<AagosOrg> org : orgs)
+    {
+      const emp::vector<size_t> &bins = org->GetHistCounts();
+      emp_assert(bins.size() == num_bins);
+      for (size_t count : bins)
+        AagosSnapshot::PutVarint(block, count);
+    }
+
+    const uint64_t payload_bytes = block.size() - AagosSnapshot::BLOCK_HEADER_BYTES;
+    for (size_t i = 0; i < 8; i++)
+      block[12 + i] = (unsigned char)(payload_bytes >> (8 * i));
+    out->write((const char *)block.data(), (std::streamsize)block.size());
+    out->flush();
+    bytes_written += block.size();
+  }
+};
+
+// streams a binary snapshot file one update at a time, so only the
+// current update is ever held in memory
+class AagosSnapshotReader
+{
+private:
+  std::ifstream file;
+  bool valid;
+  uint32_t version;
+  size_t num_genes;
+  size_t gene_size;
+  size_t num_bins;
+
+  // current block
+  size_t update;
+  size_t num_orgs;
+  emp::vector<unsigned char> payload;
+  // byte offset of each org's first genome word within payload
+  emp::vector<size_t> genome_offsets;
+  // decoded varint columns, num_genes / num_bins entries per org
+  emp::vector<size_t> gene_starts;
+  emp::vector<size_t> hist_counts;
+
+  // reads next block header, returns payload size or false at end of file
+  bool ReadBlockHeader(uint64_t &payload_bytes)
+  {
+    unsigned char header[AagosSnapshot::BLOCK_HEADER_BYTES];
+    if (!valid || !file.read((char *)header, sizeof(header)))
+      return false;
+    update = AagosSnapshot::GetUInt(header, 8);
+    num_orgs = AagosSnapshot::GetUInt(header + 8, 4);
+    payload_bytes = AagosSnapshot::GetUInt(header + 12, 8);
+    return true;
+  }
+
+public:
+  AagosSnapshotReader(const std::string &filename)
+      : file(filename, std::ios::binary)
+      , valid(false)
+      , version(0)
+      , num_genes(0)
+      , gene_size(0)
+      , num_bins(0)
+      , update(0)
+      , num_orgs(0)
+      , payload()
+      , genome_offsets()
+      , gene_starts()
+      , hist_counts()
+  {
+    unsigned char header[AagosSnapshot::FILE_HEADER_BYTES];
+    if (!file.read((char *)header, sizeof(header)))
+      return;
+    if (std::memcmp(header, AagosSnapshot::MAGIC, 8) != 0)
+      return;
+    version = (uint32_t)AagosSnapshot::GetUInt(header + 8, 4);
+    num_genes = AagosSnapshot::GetUInt(header + 12, 4);
+    gene_size = AagosSnapshot::GetUInt(header + 16, 4);
+    num_bins = AagosSnapshot::GetUInt(header + 20, 4);
+    valid = (version == AagosSnapshot::VERSION);
+  }
+
+  // whether the file opened and has a header this reader understands
+  bool IsValid() const { return valid; }
+  uint32_t GetVersion() const { return version; }
+  size_t GetNumGenes() const { return num_genes; }
+  size_t GetGeneSize() const { return gene_size; }
+  size_t GetNumBins() const { return num_bins; }
+
+  // loads the next update in the file, returns false once there are none left
+  bool NextUpdate()
+  {
+    uint64_t payload_bytes = 0;
+    if (!ReadBlockHeader(payload_bytes))
+      return false;
+    payload.resize(payload_bytes);
+    if (!file.read((char *)payload.data(), (std::streamsize)payload_bytes))
+      return false;
+
+    size_t pos = 16 * num_orgs; // skip fitness and neighbor columns
+    const size_t sizes_pos = pos;
+    pos += 4 * num_orgs;
+    genome_offsets.resize(num_orgs);
+    for (size_t i = 0; i < num_orgs; i++)
+    {
+      genome_offsets[i] = pos;
+      pos += 4 * AagosSnapshot::NumWords(AagosSnapshot::GetUInt(&payload[sizes_pos + 4 * i], 4));
+    }
+    gene_starts.resize(num_orgs * num_genes);
+    for (size_t &start : gene_starts)
+      start = AagosSnapshot::GetVarint(payload, pos);
+    hist_counts.resize(num_orgs * num_bins);
+    for (size_t &count : hist_counts)
+      count = AagosSnapshot::GetVarint(payload, pos);
+    return true;
+  }
+
+  // skips forward to the first update at or after target, returns false if there is none.
+  // Updates skipped over are never read into memory
+  bool SeekUpdate(size_t target)
+  {
+    while (valid)
+    {
+      const std::streampos block_start = file.tellg();
+      uint64_t payload_bytes = 0;
+      if (!ReadBlockHeader(payload_bytes))
+        return false;
+      if (update >= target)
+      {
+        file.seekg(block_start);
+        return NextUpdate();
+      }
+      file.seekg((std::streamoff)payload_bytes, std::ios::cur);
+    }
+    return false;
+  }
+
+  // getters for the currently loaded update
+  size_t GetUpdate() const { return update; }
+  size_t GetNumOrgs() const { return num_orgs; }
+  double GetFitness(size_t org_id) const { return AagosSnapshot::GetDouble(&payload[8 * org_id]); }
+  double GetGeneNeighbors(size_t org_id) const { return AagosSnapshot::GetDouble(&payload[8 * (num_orgs + org_id)]); }
+  size_t GetGenomeSize(size_t org_id) const { return AagosSnapshot::GetUInt(&payload[16 * num_orgs + 4 * org_id], 4); }
+
+  emp::BitVector GetGenome(size_t org_id) const
+  {
+    emp::BitVector bits(GetGenomeSize(org_id));
+    for (size_t w = 0; w < AagosSnapshot::NumWords(bits.size()); w++)
+      bits.SetUInt(w, (uint32_t)AagosSnapshot::GetUInt(&payload[genome_offsets[org_id] + 4 * w], 4));
+    return bits;
+  }
+
+  emp::vector<size_t> GetGeneStarts(size_t org_id) const
+  {
+    auto first = gene_starts.begin() + (int)(org_id * num_genes);
+    return emp::vector<size_t>(first, first + (int)num_genes);
+  }
+
+  emp::vector<size_t> GetHistCounts(size_t org_id) const
+  {
+    auto first = hist_counts.begin() + (int)(org_id * num_bins);
+    return emp::vector<size_t>(first, first + (int)num_bins);
+  }
+};
+
+#endif
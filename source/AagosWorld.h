@@ -1,19 +1,35 @@
-/// @todo Need to add cyclic environments!
-
 #ifndef AAGOS_WORLD_H
 #define AAGOS_WORLD_H
 
 #include "Evolve/NK.h"
 #include "Evolve/World.h"
 #include "tools/Binomial.h"
+#include "tools/bitset_utils.h"
 #include "tools/math.h"
 #include "tools/stats.h"
 #include "tools/string_utils.h"
 
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <sys/stat.h>
+#include <tuple>
+#include <unistd.h>
 
+#include "AagosCheckpoint.h"
+#include "AagosHashedLandscape.h"
+#include "AagosLineage.h"
 #include "AagosOrg.h"
+#include "AagosOutputSpec.h"
+#include "AagosPerf.h"
+#include "AagosSnapshot.h"
+#include "AsyncWriter.h"
+#include "MutationSampler.h"
+#include "ThreadPool.h"
 
 EMP_BUILD_CONFIG(AagosConfig,
                  GROUP(WORLD_STRUCTURE, "How should each organism's genome be setup?"),
@@ -24,6 +40,11 @@ EMP_BUILD_CONFIG(AagosConfig,
                  VALUE(ELITE_COUNT, size_t, 0, "How many organisms should be selected via elite selection?"),
                  VALUE(TOURNAMENT_SIZE, size_t, 2, "How many organisms should be chosen for each tournament?"),
                  VALUE(GRADIENT_MODEL, bool, false, "Whether the current experiment uses a gradient model for fitness or trad. fitness"),
+                 VALUE(NUM_ENVIRONMENTS, size_t, 1, "How many environments should runs cycle between? (at most 8)"),
+                 VALUE(ENVIRONMENT_PERIOD, size_t, 0, "How many updates between switching to the next environment? (0 to never switch)"),
+                 VALUE(HASHED_LANDSCAPE, bool, false, "Should NK fitness be hashed from gene and state on demand instead of stored in tables? (for large GENE_SIZE)"),
+                 VALUE(NUM_THREADS, size_t, 1, "How many threads should mutations and fitness evaluations be split across? (1 for serial)"),
+                 VALUE(POOLED_GENOMES, bool, false, "Should genomes be kept in one pool of slots sized by MAX_SIZE, so copying orgs never allocates?"),
   
 
                  GROUP(GENOME_STRUCTURE, "How should each organism's genome be setup?"),
@@ -39,23 +60,177 @@ EMP_BUILD_CONFIG(AagosConfig,
                  VALUE(BIT_INS_PROB, double, 0.01, "Probability of a single bit being inserted."),
                  VALUE(BIT_DEL_PROB, double, 0.01, "Probability of a single bit being removed."),
 
+                 GROUP(ISLANDS, "Splitting the population into demes that evolve on their own threads and swap migrants"),
+                 VALUE(NUM_DEMES, size_t, 1, "How many demes should POP_SIZE be split into? (1 for a single well-mixed population)"),
+                 VALUE(MIGRATION_INTERVAL, size_t, 100, "How many updates between migrations? (0 for no migration)"),
+                 VALUE(MIGRATION_COUNT, size_t, 1, "How many orgs should each deme send to each of its neighbors per migration?"),
+                 VALUE(MIGRATION_TOPOLOGY, std::string, "ring", "Which demes are neighbors? (ring sends to the next deme, all sends to every other deme)"),
+
                  GROUP(OUTPUT, "Output rates for Aagos"),
                  VALUE(PRINT_INTERVAL, size_t, 1000, "How many updates between prints?"),
                  VALUE(STATISTICS_INTERVAL, size_t, 1000, "How many updates between statistic gathering?"),
                  VALUE(SNAPSHOT_INTERVAL, size_t, 10000, "How many updates between snapshots?"),
-                 VALUE(DATA_FILEPATH, std::string, "", "what directory should all data files be written to?"))
+                 VALUE(BINARY_SNAPSHOT, bool, false, "Should snapshots be written to packed binary snapshot.bin instead of snapshot.csv?"),
+                 VALUE(PERF_STATS, bool, false, "Should time spent in each phase and counts of mutations, fitness evaluations and stats calculations be written to perf.csv every STATISTICS_INTERVAL?"),
+                 VALUE(ASYNC_OUTPUT, bool, false, "Should data files be written by a background thread, so evolution doesn't wait on disk?"),
+                 VALUE(OUTPUT_COLUMNS, std::string, "", "Comma separated columns to write to output.csv in place of fitness.csv, gene_stats.csv and representative_org.csv (empty for those files)"),
+                 VALUE(OUTPUT_FIRST_UPDATE, size_t, 0, "First update written to output.csv"),
+                 VALUE(OUTPUT_LAST_UPDATE, size_t, 0, "Last update written to output.csv (0 for no limit)"),
+                 VALUE(OUTPUT_EVERY, size_t, 1000, "How many updates between rows of output.csv?"),
+                 VALUE(LINEAGE_TRACKING, bool, false, "Should the ancestry of the population be tracked, and the line of descent of the fittest org written to lineage.csv at the end of the run?"),
+                 VALUE(DATA_FILEPATH, std::string, "", "what directory should all data files be written to?"),
+
+                 GROUP(CHECKPOINTS, "Saving and resuming runs"),
+                 VALUE(CHECKPOINT_INTERVAL, size_t, 0, "How many updates between checkpoints? (0 for no checkpoints)"),
+                 VALUE(RESUME, std::string, "", "DATA_FILEPATH of the run to resume from its checkpoint.bin, ./ for the current directory (empty to start a new run)"))
+
+// binomial distributions for the number of each kind of mutation an org gets.
+// Per-bit mutations need one distribution per genome length, which are only
+// built for lengths the population actually reaches. Everything here is safe to
+// read from several threads, so worlds with the same mutation settings can
+// share one set
+struct AagosMutationTables
+{
+  // settings the tables are built from
+  using key_t = std::tuple<double, double, double, double, size_t, size_t, size_t>;
+
+  size_t min_size;
+  size_t max_size;
+  emp::Binomial &gene_moves;
+  MutationSampler bit_flips;
+  MutationSampler inserts;
+  MutationSampler deletes;
+
+  AagosMutationTables(AagosConfig &config)
+      : min_size(config.MIN_SIZE())
+      , max_size(config.MAX_SIZE())
+      , gene_moves(GetSharedBinomial(config.GENE_MOVE_PROB(), config.NUM_GENES())) // since num genes doesn't evolve, can calculate 1 dist
+      , bit_flips(config.BIT_FLIP_PROB(), config.MIN_SIZE(), config.MAX_SIZE())
+      , inserts(config.BIT_INS_PROB(), config.MIN_SIZE(), config.MAX_SIZE())
+      , deletes(config.BIT_DEL_PROB(), config.MIN_SIZE(), config.MAX_SIZE())
+  {
+  }
+
+  static key_t GetKey(AagosConfig &config)
+  {
+    return key_t(config.GENE_MOVE_PROB(), config.BIT_FLIP_PROB(), config.BIT_INS_PROB(), config.BIT_DEL_PROB(),
+                 config.NUM_GENES(), config.MIN_SIZE(), config.MAX_SIZE());
+  }
+};
+
+// Streams behind the data files, written by a background writer when
+// ASYNC_OUTPUT is set. AagosWorld inherits this ahead of emp::World so the
+// writer and its streams outlive the data files emp::World deletes, and
+// whatever those flush on the way out still reaches disk. Streams are destroyed
+// first, handing off what they hold, then the writer finishes its queue.
+//
+// Each csv data file writes through a stream of its own. In a resumed run that
+// stream holds on to what is written to it, the header, until ResumeDataStreams
+// points it at its file, once LoadCheckpoint knows how much of the file to keep
+class AagosOutputStreams
+{
+protected:
+  struct DataStream
+  {
+    std::string filename;
+    std::unique_ptr<std::stringbuf> pending; // header of a resumed run's file, until the file is opened
+    std::unique_ptr<std::ostream> stream;
+  };
+
+  std::unique_ptr<AsyncWriter> async_writer; // null unless ASYNC_OUTPUT is set
+  emp::vector<std::unique_ptr<AsyncOStream>> async_streams;
+  emp::vector<std::unique_ptr<std::ofstream>> file_streams;
+  emp::vector<DataStream> data_streams; // in the order they were opened, which checkpoints rely on
+  bool resuming;
+
+  AagosOutputStreams(bool async, bool _resuming)
+      : async_writer(async ? new AsyncWriter() : nullptr)
+      , async_streams()
+      , file_streams()
+      , data_streams()
+      , resuming(_resuming)
+  {
+  }
+
+  // opens filename, through the background writer when there is one
+  std::ostream &OpenStream(const std::string &filename, std::ios::openmode mode = std::ios::out)
+  {
+    if (async_writer)
+    {
+      async_streams.emplace_back(new AsyncOStream(*async_writer, filename, mode));
+      return *async_streams.back();
+    }
+    file_streams.emplace_back(new std::ofstream(filename, mode));
+    return *file_streams.back();
+  }
+
+  // opens the stream for a csv data file. New runs start the file over
+  std::ostream &OpenDataStream(const std::string &filename)
+  {
+    data_streams.push_back(DataStream{filename, nullptr, nullptr});
+    DataStream &data_stream = data_streams.back();
+    if (resuming)
+    {
+      data_stream.pending.reset(new std::stringbuf());
+      data_stream.stream.reset(new std::ostream(data_stream.pending.get()));
+    }
+    else
+      data_stream.stream.reset(new std::ostream(OpenStream(filename).rdbuf()));
+    return *data_stream.stream;
+  }
+
+  // bytes of each csv data file written so far, flushed to disk
+  emp::vector<size_t> GetDataStreamBytes()
+  {
+    for (DataStream &data_stream : data_streams)
+      data_stream.stream->flush();
+    if (async_writer)
+      async_writer->Flush();
+    emp::vector<size_t> bytes;
+    for (const DataStream &data_stream : data_streams)
+    {
+      struct stat file_stat;
+      bytes.push_back(stat(data_stream.filename.c_str(), &file_stat) == 0 ? (size_t)file_stat.st_size : 0);
+    }
+    return bytes;
+  }
+
+  // opens the files of a resumed run, each cut back to its first resume_bytes
+  // bytes and appended to, so rows written after the checkpoint are dropped.
+  // Files with nothing to keep start over with their header
+  void ResumeDataStreams(const emp::vector<size_t> &resume_bytes)
+  {
+    emp_assert(resume_bytes.size() == data_streams.size());
+    for (size_t k = 0; k < data_streams.size(); k++)
+    {
+      DataStream &data_stream = data_streams[k];
+      if (!data_stream.pending)
+        continue;
+      const bool resume = resume_bytes[k] > 0 && truncate(data_stream.filename.c_str(), (off_t)resume_bytes[k]) == 0;
+      std::ostream &file = OpenStream(data_stream.filename, resume ? std::ios::app : std::ios::out);
+      if (!resume)
+        file << data_stream.pending->str();
+      data_stream.stream->rdbuf(file.rdbuf());
+      data_stream.pending.reset();
+    }
+  }
+};
 
-class AagosWorld : public emp::World<AagosOrg>
+class AagosWorld : private AagosOutputStreams, public emp::World<AagosOrg>
 {
 private:
   using base_t = emp::World<AagosOrg>;
 
   AagosConfig &config;
-  emp::NKLandscape landscape;
+  emp::NKLandscape landscape; // left without genes when HASHED_LANDSCAPE is set
+  AagosHashedLandscape hashed_landscape; // only used when HASHED_LANDSCAPE is set
   // need a node manager for data tracking since so many different data points to draw
   emp::DataManager<double, emp::data::Log, emp::data::Stats, emp::data::Pull> manager; 
   emp::Ptr<emp::ContainerDataFile<emp::vector<emp::Ptr<AagosOrg>>>> snapshot_file;
-  emp::vector<emp::BitVector> target_bits; // vector of target bitstrings for gradient version of model
+  emp::Ptr<AagosSnapshotWriter> binary_snapshot_file; // only used for binary snapshots
+  // target bitstrings for gradient version of model, packed one word per gene
+  // so a gene can be scored with a single XOR + popcount against its value
+  emp::vector<uint32_t> target_bits;
 
   // Configured values
   size_t num_bits;
@@ -63,117 +238,235 @@ private:
   size_t gene_size;
   size_t num_bins;
   bool gradient;
+  bool hashed; // NK fitness comes from hashed_landscape
+  size_t num_threads;
 
   std::string data_filepath;
-  emp::Binomial gene_moves_binomial;
-  emp::vector<emp::Binomial> bit_flips_binomials;
-  emp::vector<emp::Binomial> inserts_binomials;
-  emp::vector<emp::Binomial> deletes_binomials;
+  std::shared_ptr<AagosMutationTables> mut_tables;
+  // slots for every genome in the population, null unless POOLED_GENOMES is set
+  std::shared_ptr<AagosGenomePool> genome_pool;
 
   // Calculated values
   size_t gene_mask;
   int fittest_id;
+  // scores an org in the current environment, picked at startup by SelectFitnessKernel.
+  // Each gene's share is also written to gene_fitness, unless it is null
+  double (AagosWorld::*fitness_kernel)(const AagosOrg &, double *gene_fitness) const;
+  // NK landscape copied to one flat array, gene_id * 2^gene_size + gene value.
+  // Only kept (and kept in sync with landscape) when an NK kernel specialized for
+  // the configured gene count and size is in use
+  emp::vector<double> nk_table;
+  // bumped each time the environment changes, so fitness cached on orgs under
+  // an older environment is recalculated. Starts at 1 since 0 marks no cache
+  size_t env_epoch;
+
+  // Cyclic environments. Runs with NUM_ENVIRONMENTS > 1 move to the next one every
+  // ENVIRONMENT_PERIOD updates. The active environment lives in target_bits,
+  // nk_table or hashed_landscape; the others wait in the vectors below, and
+  // switching swaps the two. Orgs cache fitness separately for each environment
+  size_t num_envs;
+  size_t env_id;                               // active environment
+  emp::vector<size_t> env_epochs;              // epoch of each environment, as of when it was last active
+  emp::vector<emp::vector<uint32_t>> env_targets; // gradient model
+  emp::vector<emp::vector<double>> env_nk_tables; // NK model
+  emp::vector<AagosHashedLandscape> env_hashed;   // NK model with HASHED_LANDSCAPE
+  // genes (target bitstrings or landscape rows) touched by the environment change
+  // that started changed_epoch, sorted. Orgs scored in the epoch just before only
+  // have these genes rescored
+  emp::vector<size_t> changed_genes;
+  size_t changed_epoch;
+
+  // per-org statistics for gene_stats.csv and output.csv, one column per stat, gathered by CollectPopStats
+  struct PopStats
+  {
+    size_t update = (size_t)-1; // update the columns were gathered on
+    emp::vector<double> fitness;
+    emp::vector<double> neutral_sites;
+    emp::vector<double> one_gene_sites;
+    emp::vector<double> multi_gene_sites;
+    emp::vector<double> coding_sites;
+    emp::vector<double> gene_len;
+    emp::vector<double> avg_overlap;
+    emp::vector<double> avg_num_neighbors;
+  };
+  PopStats pop_stats;
+
+  // columns and updates of output.csv, which is only written when columns are picked
+  AagosOutputSpec output_spec;
+  emp::vector<std::function<double()>> output_funs; // one per column after update
+  std::ostream *output_out;
+
+  // phase timings and counters, null unless PERF_STATS is set
+  std::unique_ptr<AagosPerf> perf;
+  std::ostream *perf_out;
+
+  // parent of each org of the next generation, picked by SelectNextGeneration and
+  // put in place by Update. The other vectors are scratch space kept between generations
+  emp::vector<size_t> selected_ids;
+  emp::vector<double> selection_fitness;
+  emp::vector<size_t> elite_ids;
+  emp::vector<emp::Ptr<AagosOrg>> next_pop;
+  emp::vector<size_t> parent_slots;  // slot of the next generation each parent moved to
+  emp::vector<size_t> copies_needed; // slots of the next generation still waiting on a copy of their parent
+
+  // ancestry of the population, only kept when LINEAGE_TRACKING is set. Each org
+  // points at the lineage node of its genome, by slot in lineage_ids
+  bool lineage_tracking;
+  AagosLineage lineage;
+  emp::vector<size_t> lineage_ids;
+  emp::vector<size_t> next_lineage_ids;
+  emp::vector<AagosLineage::Batch> lineage_batches; // mutations staged by each worker
+
+  // workers for parallel mutation and fitness evaluation, each with its own random stream
+  ThreadPool thread_pool;
+  emp::vector<emp::Random> worker_randoms;
 
 public:
-  AagosWorld(emp::Random &rand, AagosConfig &_config, const std::string &world_name = "AagosWorld")
-      : emp::World<AagosOrg>(rand, world_name), config(_config), landscape(config.NUM_GENES(), config.GENE_SIZE() - 1, GetRandom())
+  // mutation tables can be passed in to share them with other worlds built from
+  // the same mutation settings, otherwise the world builds its own
+  AagosWorld(emp::Random &rand, AagosConfig &_config, const std::string &world_name = "AagosWorld",
+             std::shared_ptr<AagosMutationTables> _mut_tables = nullptr)
+      : AagosOutputStreams(_config.ASYNC_OUTPUT(), _config.RESUME() != ""), emp::World<AagosOrg>(rand, world_name), config(_config), landscape(config.HASHED_LANDSCAPE() ? 0 : config.NUM_GENES(), config.GENE_SIZE() - 1, GetRandom())
+        ,
+        hashed_landscape(config.HASHED_LANDSCAPE() ? GetRandom().GetUInt() : 0, config.NUM_GENES(), config.GENE_SIZE())
         // , manager()
         ,
         num_bits(config.NUM_BITS()), num_genes(config.NUM_GENES()), gene_size(config.GENE_SIZE()), num_bins(config.NUM_GENES() + 1)
         , 
          gradient(config.GRADIENT_MODEL())
         ,
+        hashed(config.HASHED_LANDSCAPE() && !config.GRADIENT_MODEL())
+        ,
+        num_threads(std::max<size_t>(config.NUM_THREADS(), 1)) // 0 would leave no thread to run on
+        ,
         data_filepath(config.DATA_FILEPATH()) // TODO: only works if subdir is made before runs start... TODO: wouldn't work if subdir not created, runs wouldn't be stored
         ,
-        gene_moves_binomial(config.GENE_MOVE_PROB(), config.NUM_GENES()) // since num genes doesn't evolve, can calculate 1 dist
+        mut_tables(_mut_tables ? _mut_tables : std::make_shared<AagosMutationTables>(config))
+        ,
+        genome_pool(config.POOLED_GENOMES() ? std::make_shared<AagosGenomePool>(config.MAX_SIZE()) : nullptr)
         ,
         gene_mask(emp::MaskLow<size_t>(config.GENE_SIZE())) 
         ,
         fittest_id(-1) // set to -1 to indicate fittest individual hasn't been calc yet
+        ,
+        fitness_kernel(&AagosWorld::CalcFitnessGeneric)
+        ,
+        env_epoch(1)
+        ,
+        num_envs(config.NUM_ENVIRONMENTS())
+        ,
+        env_id(0)
+        ,
+        env_epochs()
+        ,
+        env_targets()
+        ,
+        env_nk_tables()
+        ,
+        env_hashed()
+        ,
+        changed_genes()
+        ,
+        changed_epoch(0)
+        ,
+        output_spec(config.OUTPUT_COLUMNS(), config.OUTPUT_FIRST_UPDATE(), config.OUTPUT_LAST_UPDATE(),
+                    config.OUTPUT_EVERY())
+        ,
+        output_funs()
+        ,
+        output_out(nullptr)
+        ,
+        perf(config.PERF_STATS() ? new AagosPerf() : nullptr)
+        ,
+        perf_out(nullptr)
+        ,
+        lineage_tracking(config.LINEAGE_TRACKING())
+        ,
+        lineage()
+        ,
+        lineage_ids()
+        ,
+        next_lineage_ids()
+        ,
+        lineage_batches(lineage_tracking ? num_threads : 0)
+        ,
+        thread_pool(num_threads)
 
   {
     emp_assert(config.MIN_SIZE() >= config.GENE_SIZE(), "BitSet can't handle a genome smaller than gene_size");
     emp_assert(config.MAX_SIZE() >= config.NUM_BITS(), "the starting gene size of the organism can't be larger than the max size the organism can reach");
-    // for each possible length of genome, calculate the bin dist for that length
-    // start at smallest possible gene length
-    for (size_t i = config.MIN_SIZE(); i <= config.MAX_SIZE(); i++) {
-      bit_flips_binomials.emplace_back(config.BIT_FLIP_PROB(), i);
-      inserts_binomials.emplace_back(config.BIT_INS_PROB(), i);
-      deletes_binomials.emplace_back(config.BIT_DEL_PROB(), i);
-    }
+    emp_assert(mut_tables->min_size == config.MIN_SIZE() && mut_tables->max_size == config.MAX_SIZE(),
+               "shared mutation tables must be built for the same genome sizes");
 
   // if using gradient model, initialize target bitstrings
   if(gradient) {
+    emp_assert(gene_size <= 32, "gradient targets are packed into 32-bit words");
     for(size_t i = 0; i < num_genes; i++) {
       auto &rand = GetRandom();//TODO: is this bad?
-      target_bits.emplace_back(emp::RandomBitVector(rand, gene_size)); 
-    }
-    for(size_t i = 0; i < target_bits.size(); i++) {
-      emp_assert(target_bits[i].GetSize() == gene_size);
+      // draw through a bitvector so random draws match the unpacked targets
+      target_bits.emplace_back(emp::RandomBitVector(rand, gene_size).GetUInt(0));
     }
     // : will break if the number of genes is allowed to evolve ever
     emp_assert(target_bits.size() == num_genes, "there should be the same number of target bitstrings as genes in genomes"); 
     }
     // fitness function for aagos orgs
     auto fit_fun = [this](AagosOrg &org) { //: change to prportion of matching bits
-      double fitness = 0.0; // : use hamming distance to compare bistrings - UES
-      for (size_t gene_id = 0; gene_id < num_genes; gene_id++)
+      // each org's fitness is only calculated once between mutations and env changes
+      if (org.fitness_epoch[env_id] == env_epoch)
+        return org.fitness[env_id];
+      double fitness;
+      if (org.fitness_epoch[env_id] && org.fitness_epoch[env_id] + 1 == env_epoch && changed_epoch == env_epoch &&
+          org.gene_fitness_env == env_id)
+        fitness = RescoreChangedGenes(org);
+      else if (config.CHANGE_RATE() > 0)
       {
-        const size_t gene_pos = org.gene_starts[gene_id];
-        uint32_t gene_val = org.bits.GetUIntAtBit(gene_pos) & gene_mask;
-        // emp_assert();
-        const size_t tail_bits = num_bits - gene_pos;
-
-        // If a gene runs off the end of the bitstring, loop around to the beginning.
-        if (tail_bits < gene_size)
-        {
-          gene_val |= (org.bits.GetUInt(0) << tail_bits) & gene_mask;
-        }
-        // calculate fitness
-        if(gradient) { // remember that we're assuming here that 1st index of gene_starts maps to 1st index in target bitstring
-          
-          // emp_assert(gene_val.Get)
-
-          emp::BitVector gene = emp::BitVector(gene_size);
-          gene.SetUInt(0, gene_val);
-          fitness += (double)target_bits[gene_id].EQU(gene).count() / (double)gene_size; 
-          //calcs hamming dist between target and curr gene & adds up # of matches
-          // divide by num bits in gene so fitness range is (0, 1)
-          // std::cout << "gene   is: "<< gene << std::endl;
-          // std::cout << "target is: "<< target_bits[gene_id] << std::endl;
-          // std::cout << "fitness is: " << (double)target_bits[gene_id].EQU(gene).count() / (double)gene_size << std::endl;
-          } else {
-          fitness += landscape.GetFitness(gene_id, gene_val);
-        }
+        // keep each gene's share so the next environment change can be applied incrementally
+        emp::vector<double> &gene_fitness = org.gene_fitness.Mutable();
+        gene_fitness.resize(num_genes);
+        fitness = (this->*fitness_kernel)(org, gene_fitness.data());
+        org.gene_fitness_env = env_id;
       }
+      else
+        fitness = (this->*fitness_kernel)(org, nullptr);
+      if (perf)
+        perf->CountFitnessEval();
+      org.fitness[env_id] = fitness;
+      org.fitness_epoch[env_id] = env_epoch;
       return fitness;
     };
     SetFitFun(fit_fun);
+    SelectFitnessKernel();
+    SetupEnvironments();
 
     // Setup the mutation function. Per site.
     std::function<size_t(AagosOrg &, emp::Random &)> mut_fun =
         [this](AagosOrg &org, emp::Random &random) {
-          size_t bin_array_offset = org.GetNumBits() - config.MIN_SIZE(); // offset is num bits - min size of genome
-          // std::cout << "org.GetNumBits: " << org.GetNumBits() << " and config.MIN_SIZE(): " << config.MIN_SIZE() << "and gene size: " << config.GENE_SIZE() << std::endl;
-          emp_assert(bin_array_offset >= 0, "index of bin dist cannot be negative!!");
+          const size_t num_bits = org.GetNumBits(); // per-bit mutation counts depend on genome length
+          // mutations are noted here for the lineage when tracking it
+          emp::vector<AagosLineage::Delta> *lineage_log = lineage_tracking ? &AagosLineage::ThreadLog() : nullptr;
           // Do gene moves.
-          size_t num_moves = gene_moves_binomial.PickRandom(random);
+          size_t num_moves = mut_tables->gene_moves.PickRandom(random);
           for (size_t m = 0; m < num_moves; m++)
           {
             size_t gene_id = random.GetUInt(org.GetNumGenes()); // get random gene
-            org.gene_starts[gene_id] = random.GetUInt(org.GetNumBits()); // change its start to a random location
+            const size_t new_start = random.GetUInt(org.GetNumBits());
+            org.MoveGene(gene_id, new_start); // change its start to a random location
+            if (lineage_log)
+              lineage_log->push_back({(uint32_t)gene_id, (uint32_t)new_start, AagosLineage::GENE_MOVE});
           }
 
-          size_t num_flips = bit_flips_binomials[bin_array_offset].PickRandom(random);
+          size_t num_flips = mut_tables->bit_flips.PickRandom(random, num_bits);
           for (size_t m = 0; m < num_flips; m++)
           {
             const size_t pos = random.GetUInt(org.GetNumBits());
-            org.bits[pos] ^= 1;
+            org.bits.Toggle(pos);
+            if (lineage_log)
+              lineage_log->push_back({(uint32_t)pos, 0, AagosLineage::BIT_FLIP});
           }
 
           // Get num of insertions and deletions.
-          int num_insert = (int)inserts_binomials[bin_array_offset].PickRandom(random);
-          int num_delete = (int)deletes_binomials[bin_array_offset].PickRandom(random);
+          int num_insert = (int)mut_tables->inserts.PickRandom(random, num_bits);
+          int num_delete = (int)mut_tables->deletes.PickRandom(random, num_bits);
           const int proj_size = (int)org.bits.GetSize() + num_insert - num_delete;
 
           // checks gene size is within range
@@ -191,55 +484,598 @@ public:
                        "the genome size can't be smaller than the genome length, else BitSet breaks");
           emp_assert((int)org.bits.GetSize() + num_insert - num_delete <= config.MAX_SIZE(), "some limit on bloat of program");
 
-          // Do insertions
-          for (int i = 0; i < num_insert; i++) // For each insertion that occurs,
+          // Sample insertions and deletions in the same order they would be applied
+          // one at a time, each position relative to the genome after the last
+          // event, then apply them all in one pass.
+          if (num_insert > 0 || num_delete > 0)
           {
-            const size_t pos = random.GetUInt(org.GetNumBits()); // Figure out position for insertion.
-            org.bits.Resize(org.bits.GetSize() + 1);             // Increase size to make room for insertion.
-            emp::BitVector mask(pos, 1);                         // Setup a mask to preserve early bits.
-            mask.Resize(org.bits.GetSize());                     // Align mask size.
-
-            // Now build the new string!
-            org.bits = (mask & org.bits) | ((org.bits << 1) & ~mask);
-            org.bits[pos] = random.P(0.5); // Randomize the new bit.
-
-            // Shift any genes that started at pos or later.
-            for (auto &x : org.gene_starts)
-              if (x >= pos)
-                x++;
-          }
-
-          // Do deletions
-          for (int i = 0; i < num_delete; i++) // For each deletion that occurs,
-          {
-            size_t pos = random.GetUInt(org.GetNumBits()); // Figure out position to delete.
-            emp::BitVector mask(pos, 1);                   // Setup a mask to preserve early bits.
-            mask.Resize(org.bits.GetSize());               // Align mask size.
-
-            org.bits = (mask & org.bits) | ((org.bits >> 1) & ~mask); // Build the new string!
-            org.bits.Resize(org.bits.GetSize() - 1);                  // Decrease size to account for deletion
-
-            // Shift any genes that started at pos or later.
-            if (pos == 0)
-              pos = 1; // Adjust position if beginning was deleted.
-            for (auto &x : org.gene_starts)
-              if (x >= pos)
-                x--;
+            emp::vector<size_t> insert_pos((size_t)num_insert);
+            emp::vector<bool> insert_vals((size_t)num_insert);
+            emp::vector<size_t> delete_pos((size_t)num_delete);
+            for (int i = 0; i < num_insert; i++) // For each insertion that occurs,
+            {
+              insert_pos[(size_t)i] = random.GetUInt(org.GetNumBits() + (size_t)i); // Figure out position for insertion.
+              insert_vals[(size_t)i] = random.P(0.5);                               // Randomize the new bit.
+            }
+            const size_t mid_size = org.GetNumBits() + (size_t)num_insert;
+            for (int i = 0; i < num_delete; i++) // For each deletion that occurs,
+            {
+              delete_pos[(size_t)i] = random.GetUInt(mid_size - (size_t)i); // Figure out position to delete.
+            }
+            org.DoIndels(insert_pos, insert_vals, delete_pos);
+            if (lineage_log)
+            {
+              for (size_t i = 0; i < insert_pos.size(); i++)
+                lineage_log->push_back({(uint32_t)insert_pos[i], (uint32_t)insert_vals[i], AagosLineage::BIT_INSERT});
+              for (size_t pos : delete_pos)
+                lineage_log->push_back({(uint32_t)pos, 0, AagosLineage::BIT_DELETE});
+            }
           }
 
+          // gene moves and indels keep the histogram up to date themselves, and
+          // bit flips never change which bits genes sit on
+          if (perf)
+            perf->CountMutations(num_moves, num_flips, (size_t)num_insert, (size_t)num_delete);
           int num_muts = (int)num_moves + (int)num_flips + (int)num_insert + (int)num_delete;
           if (num_muts > 0) {
-            org.ResetHistogram();
+            org.ResetFitness();
           }
           return (int)num_moves + (int)num_flips + (int)num_insert + (int)num_delete; // Returns total num mutations
         };
     SetMutFun(mut_fun);       // set mutation function of world to above
-    SetPopStruct_Mixed(true); // uses well-mixed population structure
+    // uses well-mixed population structure. Generations are asynchronous as far as
+    // emp is concerned, so its Update never swaps populations; RunUpdate's selection
+    // puts the next generation in place itself once the data files are written.
+    // Worlds driven by emp's selectors instead need SetPopStruct_Mixed(true)
+    SetPopStruct_Mixed(false);
     SetDataTracking();        // sets up data tracking
-    
+
+    // worker streams are seeded from the world seed so parallel runs are
+    // reproducible for a given seed and thread count
+    if (num_threads > 1)
+    {
+      emp::Random seed_random(GetRandom().GetSeed());
+      for (size_t i = 0; i < num_threads; i++)
+      {
+        worker_randoms.emplace_back(seed_random.GetInt(1, std::numeric_limits<int>::max()));
+      }
+    }
+  }
+
+  ~AagosWorld()
+  {
+    if (binary_snapshot_file)
+      binary_snapshot_file.Delete();
+  }
+
+  // one gene's share of org's fitness in the current environment
+  double ScoreGene(const AagosOrg &org, size_t gene_id) const
+  {
+    // genes running off the end of the bitstring loop around to the beginning
+    const uint32_t gene_val = org.GetGeneValue(gene_id, (uint32_t)gene_mask);
+    if(gradient) { // remember that we're assuming here that 1st index of gene_starts maps to 1st index in target bitstring
+      // matching bits are those left unset by XOR with the target; both words are
+      // already masked to gene_size, so no temporaries are needed to score the gene
+      const size_t num_matches = gene_size - emp::count_bits(target_bits[gene_id] ^ gene_val);
+      // divide by num bits in gene so fitness range is (0, 1)
+      return (double)num_matches / (double)gene_size;
+    }
+    if (hashed)
+      return hashed_landscape.GetFitness(gene_id, gene_val);
+    if (nk_table.size())
+      return nk_table[gene_id * landscape.GetStateCount() + gene_val];
+    return landscape.GetFitness(gene_id, gene_val);
+  }
+
+  // fitness of org under any settings, scoring one gene at a time
+  double CalcFitnessGeneric(const AagosOrg &org, double *gene_fitness) const
+  {
+    double fitness = 0.0; // : use hamming distance to compare bistrings - UES
+    for (size_t gene_id = 0; gene_id < num_genes; gene_id++)
+    {
+      const double gene_score = ScoreGene(org, gene_id);
+      if (gene_fitness)
+        gene_fitness[gene_id] = gene_score;
+      fitness += gene_score;
+    }
+    return fitness;
+  }
+
+  // fitness of an org last scored just before the latest environment change,
+  // rescoring only the genes that change touched. The shares are summed in gene
+  // order like the kernels, so the result is exactly what a full rescore gives.
+  // Orgs none of whose touched genes changed score keep their fitness, and keep
+  // sharing their gene shares with their relatives
+  double RescoreChangedGenes(AagosOrg &org) const
+  {
+    emp_assert(org.gene_fitness.Get().size() == num_genes, org.gene_fitness.Get().size());
+    const emp::vector<double> &old_fitness = org.gene_fitness.Get();
+    bool any_changed = false;
+    for (size_t gene_id : changed_genes)
+    {
+      if (ScoreGene(org, gene_id) != old_fitness[gene_id])
+      {
+        any_changed = true;
+        break;
+      }
+    }
+    if (!any_changed)
+      return org.fitness[env_id];
+    emp::vector<double> &gene_fitness = org.gene_fitness.Mutable();
+    for (size_t gene_id : changed_genes)
+      gene_fitness[gene_id] = ScoreGene(org, gene_id);
+    double fitness = 0.0;
+    for (double gene_score : gene_fitness)
+      fitness += gene_score;
+    return fitness;
+  }
+
+  // NK fitness of org with the gene count and gene size fixed at compile time,
+  // so the gene loop unrolls and the gene mask is a constant. Genes are scored
+  // from nk_table and summed in the same order as CalcFitnessGeneric, so both
+  // give exactly the same fitness
+  template <size_t NUM_GENES, size_t GENE_SIZE>
+  double CalcNKFitness(const AagosOrg &org, double *gene_fitness) const
+  {
+    constexpr uint32_t mask = ((uint32_t)1 << GENE_SIZE) - 1;
+    constexpr size_t num_states = (size_t)1 << GENE_SIZE;
+    emp_assert(org.GetNumGenes() == NUM_GENES && nk_table.size() == NUM_GENES * num_states);
+    const double *table = nk_table.data();
+    double fitness = 0.0;
+    for (size_t gene_id = 0; gene_id < NUM_GENES; gene_id++)
+    {
+      const double gene_score = table[gene_id * num_states + org.GetGeneValue(gene_id, mask)];
+      if (gene_fitness)
+        gene_fitness[gene_id] = gene_score;
+      fitness += gene_score;
+    }
+    return fitness;
+  }
+
+  // picks a specialized NK kernel when one exists for the configured gene count and
+  // size, and the generic scoring otherwise. Add a line here to specialize more settings
+  void SelectFitnessKernel()
+  {
+    fitness_kernel = &AagosWorld::CalcFitnessGeneric;
+    nk_table.resize(0);
+    if (gradient || hashed)
+      return;
+    if (num_genes == 16 && gene_size == 8)
+      fitness_kernel = &AagosWorld::CalcNKFitness<16, 8>;
+    else if (num_genes == 16 && gene_size == 4)
+      fitness_kernel = &AagosWorld::CalcNKFitness<16, 4>;
+    else
+      return;
+    RefreshNKTable();
+  }
+
+  // draws the environments after the first for cyclic runs, the same way the
+  // first was drawn. NK runs without a specialized kernel get an nk_table too,
+  // so every environment is a table that can be swapped in
+  void SetupEnvironments()
+  {
+    // orgs only have room to cache fitness for MAX_ENVIRONMENTS environments
+    if (num_envs == 0 || num_envs > AagosOrg::MAX_ENVIRONMENTS)
+    {
+      std::cerr << "NUM_ENVIRONMENTS must be from 1 to " << (size_t)AagosOrg::MAX_ENVIRONMENTS
+                << ", running with a single environment" << std::endl;
+      num_envs = 1;
+    }
+    env_epochs.assign(num_envs, 1);
+    if (num_envs == 1)
+      return;
+    auto &rand = GetRandom();
+    if (gradient)
+    {
+      env_targets.resize(num_envs);
+      for (size_t env = 1; env < num_envs; env++)
+        for (size_t i = 0; i < num_genes; i++)
+          env_targets[env].emplace_back(emp::RandomBitVector(rand, gene_size).GetUInt(0));
+    }
+    else if (hashed)
+    {
+      env_hashed.push_back(AagosHashedLandscape(0, num_genes, gene_size)); // stands in for the active one
+      for (size_t env = 1; env < num_envs; env++)
+        env_hashed.push_back(AagosHashedLandscape(rand.GetUInt(), num_genes, gene_size));
+    }
+    else
+    {
+      if (nk_table.empty())
+        RefreshNKTable();
+      env_nk_tables.resize(num_envs);
+      for (size_t env = 1; env < num_envs; env++)
+      {
+        env_nk_tables[env].resize(nk_table.size());
+        for (double &state_fitness : env_nk_tables[env])
+          state_fitness = rand.GetDouble();
+      }
+    }
   }
 
-  ~AagosWorld() { ; }
+  // environment active during an update of a cyclic run
+  size_t EnvironmentForUpdate(size_t env_update) const
+  {
+    if (num_envs == 1 || config.ENVIRONMENT_PERIOD() == 0)
+      return 0;
+    return (env_update / config.ENVIRONMENT_PERIOD()) % num_envs;
+  }
+
+  // makes another environment active. Only the environments trade places, and
+  // fitness orgs cached for the new environment stays valid unless the org or
+  // the environment has changed since
+  void SwitchEnvironment(size_t new_env_id)
+  {
+    emp_assert(new_env_id < num_envs, new_env_id);
+    if (new_env_id == env_id)
+      return;
+    if (gradient)
+    {
+      std::swap(target_bits, env_targets[env_id]);
+      std::swap(target_bits, env_targets[new_env_id]);
+    }
+    else if (hashed)
+    {
+      std::swap(hashed_landscape, env_hashed[env_id]);
+      std::swap(hashed_landscape, env_hashed[new_env_id]);
+    }
+    else
+    {
+      std::swap(nk_table, env_nk_tables[env_id]);
+      std::swap(nk_table, env_nk_tables[new_env_id]);
+    }
+    env_epochs[env_id] = env_epoch;
+    env_id = new_env_id;
+    env_epoch = env_epochs[env_id];
+    changed_epoch = 0; // the genes last changed belong to the old environment
+  }
+
+  // targets, NK table or hashed landscape of an environment, whether active or not
+  emp::vector<uint32_t> &EnvTargets(size_t env) { return env == env_id ? target_bits : env_targets[env]; }
+  emp::vector<double> &EnvNKTable(size_t env) { return env == env_id ? nk_table : env_nk_tables[env]; }
+  AagosHashedLandscape &EnvHashedLandscape(size_t env) { return env == env_id ? hashed_landscape : env_hashed[env]; }
+
+  // copies the NK landscape into nk_table, after any change to the landscape
+  void RefreshNKTable()
+  {
+    const size_t num_states = landscape.GetStateCount();
+    nk_table.resize(num_genes * num_states);
+    for (size_t gene_id = 0; gene_id < num_genes; gene_id++)
+      for (size_t state = 0; state < num_states; state++)
+        nk_table[gene_id * num_states + state] = landscape.GetFitness(gene_id, state);
+  }
+
+  // fills the world with POP_SIZE randomized organisms
+  void InitPopulation()
+  {
+    emp::Random &random = GetRandom();
+    for (size_t i = 0; i < config.POP_SIZE(); i++)
+    {
+      AagosOrg next_org(num_bits, num_genes, gene_size, genome_pool); // build org
+      next_org.Randomize(random);                        // randomize org
+      Inject(next_org);                                  // inject org
+    }
+  }
+
+  // runs a single generation: mutation, selection, then environmental change
+  void RunUpdate()
+  {
+    // Do mutations on the population.
+    {
+      auto timer = TimePhase(AagosPerf::MUTATION);
+      DoMutations(config.ELITE_COUNT());
+    }
+
+    // when timing phases, score everyone up front so fitness time isn't counted
+    // as selection. Fitness is cached, so selection gives the same result
+    if (perf)
+    {
+      auto timer = TimePhase(AagosPerf::FITNESS);
+      EvaluateFitness();
+    }
+
+    {
+      auto timer = TimePhase(AagosPerf::SELECTION);
+      // Keep the best individuals and run a tournament for the rest
+      SelectNextGeneration(config.ELITE_COUNT(), config.TOURNAMENT_SIZE(), config.POP_SIZE() - config.ELITE_COUNT());
+    }
+
+    // Update world
+    Update();
+  }
+
+  // picks the parents of the next generation: the elite_count fittest orgs, then
+  // the winner of each tournament. Orgs are drawn and ties broken exactly as by
+  // emp::EliteSelect and emp::TournamentSelect, but fitness is read once into an
+  // array and no orgs are built until Update puts the new generation in place
+  void SelectNextGeneration(size_t elite_count, size_t tournament_size, size_t num_tournaments)
+  {
+    const size_t size = pop.size();
+    emp_assert(GetNumOrgs() == size, "selection expects a full population");
+    emp_assert(elite_count <= size && tournament_size > 0, elite_count, tournament_size);
+    selection_fitness.resize(size);
+    for (size_t i = 0; i < size; i++)
+      selection_fitness[i] = CalcFitnessID(i);
+    const double *fitness = selection_fitness.data();
+    selected_ids.resize(0);
+
+    // fittest first, with ties going to the later org as in emp::EliteSelect
+    if (elite_count)
+    {
+      elite_ids.resize(size);
+      for (size_t i = 0; i < size; i++)
+        elite_ids[i] = i;
+      std::partial_sort(elite_ids.begin(), elite_ids.begin() + (std::ptrdiff_t)elite_count, elite_ids.end(),
+                        [fitness](size_t a, size_t b) {
+                          return fitness[a] > fitness[b] || (fitness[a] == fitness[b] && a > b);
+                        });
+      selected_ids.insert(selected_ids.end(), elite_ids.begin(), elite_ids.begin() + (std::ptrdiff_t)elite_count);
+    }
+
+    // entrants are drawn with replacement, and the first of the fittest wins
+    emp::Random &random = GetRandom();
+    for (size_t t = 0; t < num_tournaments; t++)
+    {
+      size_t best_id = random.GetUInt(size);
+      for (size_t i = 1; i < tournament_size; i++)
+      {
+        const size_t entrant = random.GetUInt(size);
+        if (fitness[entrant] > fitness[best_id])
+          best_id = entrant;
+      }
+      selected_ids.push_back(best_id);
+    }
+  }
+
+  // makes the orgs picked by SelectNextGeneration the population. Each parent
+  // moves to the first slot it was picked for, and further copies overwrite
+  // orgs that weren't picked, so a generation the size of the last one builds
+  // and destroys no orgs at all
+  void PlaceNextGeneration()
+  {
+    const size_t size = pop.size();
+    if (lineage_ids.size())
+    {
+      // each org of the next generation starts out on its parent's node
+      next_lineage_ids.resize(selected_ids.size());
+      for (size_t slot = 0; slot < selected_ids.size(); slot++)
+      {
+        next_lineage_ids[slot] = lineage_ids[selected_ids[slot]];
+        lineage.AddRef(next_lineage_ids[slot]);
+      }
+      for (size_t id : lineage_ids)
+        lineage.Release(id);
+      lineage_ids.swap(next_lineage_ids);
+    }
+    next_pop.assign(selected_ids.size(), nullptr);
+    parent_slots.resize(size);
+    copies_needed.resize(0);
+    for (size_t slot = 0; slot < selected_ids.size(); slot++)
+    {
+      emp::Ptr<AagosOrg> &parent = pop[selected_ids[slot]];
+      if (parent)
+      {
+        next_pop[slot] = parent;
+        parent_slots[selected_ids[slot]] = slot;
+        parent = nullptr;
+      }
+      else
+        copies_needed.push_back(slot);
+    }
+    // what's left in pop are the orgs nobody picked
+    size_t free_id = 0;
+    for (size_t slot : copies_needed)
+    {
+      const AagosOrg &parent = *next_pop[parent_slots[selected_ids[slot]]];
+      while (free_id < size && !pop[free_id])
+        free_id++;
+      if (free_id < size)
+      {
+        *pop[free_id] = parent;
+        next_pop[slot] = pop[free_id];
+        pop[free_id] = nullptr;
+      }
+      else
+        next_pop[slot] = emp::NewPtr<AagosOrg>(parent);
+    }
+    // orgs left over when the new generation is smaller than the last
+    for (emp::Ptr<AagosOrg> &org : pop)
+      if (org)
+        org.Delete();
+    pop.swap(next_pop);
+    num_orgs = pop.size();
+    selected_ids.resize(0);
+  }
+
+  // adds the time until the returned timer is destroyed to phase, when PERF_STATS is set
+  AagosPerf::PhaseTimer TimePhase(AagosPerf::Phase phase) { return AagosPerf::PhaseTimer(perf.get(), phase); }
+
+  // mutates every organism from start_id on. When running in parallel, the
+  // population is split into one contiguous block per worker, and each worker
+  // mutates its block with its own random stream and then evaluates its fitness
+  void DoMutations(size_t start_id = 0)
+  {
+    if (lineage_tracking && lineage_ids.empty())
+      StartLineage();
+    if (num_threads <= 1)
+    {
+      if (!lineage_tracking)
+      {
+        base_t::DoMutations(start_id);
+        return;
+      }
+      // the same draws as the base loop, with each org's mutations staged for the lineage
+      for (size_t i = start_id; i < pop.size(); i++)
+      {
+        if (pop[i])
+          MutateSlot(i, GetRandom(), lineage_batches[0]);
+      }
+    }
+    else
+    {
+      RunOnBlocks([this, start_id](size_t worker_id, size_t begin, size_t end) {
+        emp::Random &random = worker_randoms[worker_id];
+        for (size_t i = begin; i < end; i++)
+        {
+          if (!pop[i])
+            continue;
+          if (i >= start_id)
+          {
+            if (lineage_tracking)
+              MutateSlot(i, random, lineage_batches[worker_id]);
+            else
+              mut_fun(*pop[i], random);
+          }
+          fit_fun(*pop[i]); // caches fitness on org for selection
+        }
+      });
+    }
+    if (lineage_tracking)
+      CommitLineage();
+  }
+
+  // mutates the org in slot i, staging its mutations in batch if it had any
+  void MutateSlot(size_t i, emp::Random &random, AagosLineage::Batch &batch)
+  {
+    emp::vector<AagosLineage::Delta> &log = AagosLineage::ThreadLog();
+    log.resize(0);
+    mut_fun(*pop[i], random);
+    if (log.size())
+      batch.Add(i, log);
+  }
+
+  // starts tracking ancestry from the current population, with each org the
+  // root of its own tree. Ancestry is followed through RunUpdate's selection
+  void StartLineage()
+  {
+    emp_assert(GetNumOrgs() == pop.size(), "lineage tracking expects a full population");
+    lineage_ids.resize(pop.size());
+    for (size_t i = 0; i < pop.size(); i++)
+      lineage_ids[i] = AddLineageRoot(i);
+  }
+
+  // new lineage tree rooted at the genome of the org in slot i, with the org's reference
+  size_t AddLineageRoot(size_t i)
+  {
+    const AagosGenome &bits = pop[i]->GetBits();
+    AagosLineage::RootGenome root{bits.size(), emp::vector<uint32_t>(bits.NumWords()), pop[i]->GetGeneStarts()};
+    for (size_t w = 0; w < root.words.size(); w++)
+      root.words[w] = bits.GetUInt(w);
+    const size_t id = lineage.AddRoot(update, root);
+    lineage.AddRef(id);
+    return id;
+  }
+
+  // gives the org in slot i a new genome and gene starts, e.g. those of a migrant
+  // from another world. Words are packed 32 bits to a word, first bit lowest.
+  // When tracking lineage the org starts a tree of its own
+  void ReplaceGenome(size_t i, const emp::vector<uint32_t> &words, size_t genome_size,
+                     const emp::vector<size_t> &gene_starts)
+  {
+    emp_assert(pop[i] && gene_starts.size() == num_genes, i);
+    AagosOrg &org = *pop[i];
+    org.bits.Assign(words, genome_size);
+    org.gene_starts.Mutable() = gene_starts;
+    org.ResetHistogram();
+    org.ResetFitness();
+    fittest_id = -1;
+    if (lineage_ids.size())
+    {
+      const size_t old_id = lineage_ids[i];
+      lineage_ids[i] = AddLineageRoot(i);
+      lineage.Release(old_id);
+    }
+  }
+
+  // moves every org that mutated onto a new node. Batches are taken in worker
+  // order, which is slot order, so nodes are numbered the same for any thread count
+  void CommitLineage()
+  {
+    for (AagosLineage::Batch &batch : lineage_batches)
+    {
+      for (size_t k = 0; k < batch.slots.size(); k++)
+      {
+        const size_t slot = batch.slots[k];
+        const size_t begin = k ? batch.ends[k - 1] : 0;
+        const size_t parent = lineage_ids[slot];
+        lineage_ids[slot] = lineage.AddChild(parent, update, batch.deltas.data() + begin, batch.ends[k] - begin);
+        lineage.AddRef(lineage_ids[slot]);
+        lineage.Release(parent);
+      }
+      batch.Clear();
+    }
+  }
+
+  const AagosLineage &GetLineage() const { return lineage; }
+  // lineage node of the org in slot i, once tracking has started
+  size_t GetLineageID(size_t i) const { return lineage_ids[i]; }
+
+  // rebuilds the genome of a lineage node by replaying the mutations from its root
+  AagosOrg RebuildLineageOrg(size_t node) const
+  {
+    const emp::vector<size_t> ancestry = lineage.GetAncestry(node);
+    const AagosLineage::RootGenome &root = lineage.GetRoot(ancestry[0]);
+    AagosOrg org(root.num_bits, num_genes, gene_size);
+    for (size_t w = 0; w < root.words.size(); w++)
+      org.bits.SetUInt(w, root.words[w]);
+    org.gene_starts.Mutable() = root.gene_starts;
+    emp::vector<size_t> insert_pos;
+    emp::vector<bool> insert_vals;
+    emp::vector<size_t> delete_pos;
+    for (size_t k = 1; k < ancestry.size(); k++)
+    {
+      insert_pos.resize(0);
+      insert_vals.resize(0);
+      delete_pos.resize(0);
+      const AagosLineage::Delta *deltas = lineage.GetDeltas(ancestry[k]);
+      for (size_t i = 0; i < lineage.GetNumDeltas(ancestry[k]); i++)
+      {
+        const AagosLineage::Delta &delta = deltas[i];
+        switch (delta.type)
+        {
+        case AagosLineage::GENE_MOVE: org.MoveGene(delta.a, delta.b); break;
+        case AagosLineage::BIT_FLIP: org.bits.Toggle(delta.a); break;
+        case AagosLineage::BIT_INSERT: insert_pos.push_back(delta.a); insert_vals.push_back(delta.b); break;
+        case AagosLineage::BIT_DELETE: delete_pos.push_back(delta.a); break;
+        }
+      }
+      org.DoIndels(insert_pos, insert_vals, delete_pos);
+    }
+    return org;
+  }
+
+  // writes the line of descent of the fittest org to lineage.csv, when tracking lineage
+  void WriteLineage()
+  {
+    if (lineage_ids.empty())
+      return;
+    FindFittest();
+    std::ofstream lineage_file(data_filepath + "lineage.csv");
+    lineage.WriteAncestry(lineage_file, lineage_ids[(size_t)fittest_id]);
+  }
+
+  // calculates and caches fitness of every organism across all workers
+  void EvaluateFitness()
+  {
+    RunOnBlocks([this](size_t, size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++)
+      {
+        if (pop[i])
+          fit_fun(*pop[i]);
+      }
+    });
+  }
+
+  // splits the population into one contiguous block of ids per worker and runs
+  // fun(worker_id, begin, end) on each block in parallel
+  void RunOnBlocks(const std::function<void(size_t, size_t, size_t)> &fun)
+  {
+    const size_t block_size = (pop.size() + num_threads - 1) / num_threads;
+    thread_pool.Run([this, &fun, block_size](size_t worker_id) {
+      const size_t begin = std::min(worker_id * block_size, pop.size());
+      const size_t end = std::min(begin + block_size, pop.size());
+      fun(worker_id, begin, end);
+    });
+  }
 
   // Finds fittest individual in the curr population
   void FindFittest()
@@ -269,134 +1105,198 @@ public:
     return valid_orgs;
   }
 
+  // adds a data file to the world, written through its own data stream
+  emp::DataFile &SetupDataFile(const std::string &filename)
+  {
+    emp::Ptr<emp::DataFile> file;
+    file.New(OpenDataStream(filename));
+    AddDataFile(file);
+    return *file;
+  }
+
+  // fitness.csv, with the same columns as emp::World::SetupFitnessFile
+  emp::DataFile &SetupFitnessDataFile(const std::string &filename)
+  {
+    emp::DataFile &file = SetupDataFile(filename);
+    auto &node = *GetFitnessDataNode();
+    file.AddVar(update, "update", "Update");
+    file.AddMean(node, "mean_fitness", "Average organism fitness in current population.");
+    file.AddMin(node, "min_fitness", "Minimum organism fitness in current population.");
+    file.AddMax(node, "max_fitness", "Maximum organism fitness in current population.");
+    file.AddInferiority(node, "inferiority", "Average fitness / maximum fitness in current population.");
+    file.PrintHeaderKeys();
+    return file;
+  }
+
   // sets up all data tracking for world
   // includes both snapshots and statistics
   void SetDataTracking()
   {
-    SetupFitnessFile(data_filepath + "fitness.csv").SetTimingRepeat(config.STATISTICS_INTERVAL()); // set timing to interval
-    SetStatsFile();          // sets up all data files for generals stats
-    SetRepresentativeFile(); // sets up all data files for representative pop member (stats runs only)
+    if (output_spec.IsEnabled())
+    {
+      SetOutputFile(); // only the statistics asked for, all in one file
+    }
+    else
+    {
+      SetupFitnessDataFile(data_filepath + "fitness.csv").SetTimingRepeat(config.STATISTICS_INTERVAL()); // set timing to interval
+      SetStatsFile();          // sets up all data files for generals stats
+      SetRepresentativeFile(); // sets up all data files for representative pop member (stats runs only)
+    }
     SetSnapshotFile();       // sets up all data files for snapshots
+    if (perf)
+    {
+      perf_out = &OpenDataStream(data_filepath + "perf.csv");
+      AagosPerf::WriteHeader(*perf_out);
+    }
+  }
+
+  // sets up output.csv with the columns picked by OUTPUT_COLUMNS. Column names
+  // match those of fitness.csv and gene_stats.csv, and representative org
+  // columns are those of representative_org.csv with a rep_ prefix
+  void SetOutputFile()
+  {
+    // min, mean and max of one of the per-org columns of CollectPopStats
+    auto add_stats = [this](std::map<std::string, std::function<double()>> &columns, const std::string &min_key,
+                            const std::string &mean_key, const std::string &max_key,
+                            emp::vector<double> PopStats::*column) {
+      columns[min_key] = [this, column]() {
+        const emp::vector<double> &values = CollectPopStats().*column;
+        return values.size() ? *std::min_element(values.begin(), values.end()) : 0.0;
+      };
+      columns[mean_key] = [this, column]() { return emp::Mean(CollectPopStats().*column); };
+      columns[max_key] = [this, column]() {
+        const emp::vector<double> &values = CollectPopStats().*column;
+        return values.size() ? *std::max_element(values.begin(), values.end()) : 0.0;
+      };
+    };
+    std::map<std::string, std::function<double()>> columns;
+    add_stats(columns, "min_fitness", "mean_fitness", "max_fitness", &PopStats::fitness);
+    add_stats(columns, "neutral_sites_min", "neutral_sites_mean", "neutral_sites_max", &PopStats::neutral_sites);
+    add_stats(columns, "one_gene_sites_min", "one_gene_sites_mean", "one_gene_sites_max", &PopStats::one_gene_sites);
+    add_stats(columns, "multi_gene_sites_min", "multi_gene_sites_mean", "multi_gene_sites_max",
+              &PopStats::multi_gene_sites);
+    add_stats(columns, "overlap_min", "overlap_mean", "overlap_max", &PopStats::avg_overlap);
+    add_stats(columns, "neighbor_genes_min", "neighbor_genes_mean", "neighbor_genes_max", &PopStats::avg_num_neighbors);
+    add_stats(columns, "coding_sites_min", "coding_sites_mean", "coding_sites_max", &PopStats::coding_sites);
+    add_stats(columns, "gene_length_min", "gene_length_mean", "gene_length_max", &PopStats::gene_len);
+    columns["rep_fitness"] = [this]() {
+      FindFittest();
+      return CalcFitnessID((size_t)fittest_id);
+    };
+    columns["rep_coding_sites"] = [this]() {
+      FindFittest();
+      const emp::vector<size_t> &bins = pop[(size_t)fittest_id]->GetHistCounts();
+      size_t count = 0;
+      for (size_t i = 1; i < bins.size(); i++) // start with bin corresponding to one gene
+        count += bins[i];
+      return (double)count;
+    };
+    columns["rep_genome_length"] = [this]() {
+      FindFittest();
+      return (double)pop[(size_t)fittest_id]->GetNumBits();
+    };
+    columns["rep_gene_neighbors"] = [this]() {
+      FindFittest();
+      return emp::Mean(pop[(size_t)fittest_id]->GetGeneNeighbors());
+    };
+
+    std::string header = "update";
+    for (const std::string &name : output_spec.columns)
+    {
+      auto column = columns.find(name);
+      if (column == columns.end())
+      {
+        std::cerr << "Unknown OUTPUT_COLUMNS column " << name << ", leaving it out of output.csv" << std::endl;
+        continue;
+      }
+      output_funs.push_back(column->second);
+      header += "," + name;
+    }
+
+    output_out = &OpenDataStream(data_filepath + "output.csv");
+    *output_out << header << std::endl;
+  }
+
+  // writes a row of output.csv for the current update
+  void WriteOutputRow()
+  {
+    *output_out << update;
+    for (const std::function<double()> &fun : output_funs)
+      *output_out << ',' << fun();
+    *output_out << std::endl;
+  }
+
+  // Gathers every per-org statistic in gene_stats.csv in one sweep of the
+  // population, reading each org's histogram once. Results are kept for the
+  // rest of the update, so the stats nodes all share a single sweep
+  const PopStats &CollectPopStats()
+  {
+    if (pop_stats.update == update)
+      return pop_stats;
+    pop_stats.update = update;
+    for (emp::vector<double> *column : {&pop_stats.fitness, &pop_stats.neutral_sites, &pop_stats.one_gene_sites, &pop_stats.multi_gene_sites,
+                                        &pop_stats.coding_sites, &pop_stats.gene_len, &pop_stats.avg_overlap,
+                                        &pop_stats.avg_num_neighbors})
+      column->resize(0);
+    for (emp::Ptr<AagosOrg> org : pop)
+    {
+      if (!org)
+        continue;
+      pop_stats.fitness.emplace_back(CalcFitnessOrg(*org));
+      const emp::vector<size_t> &bins = org->GetHistCounts();
+      size_t coding = 0;
+      for (size_t i = 1; i < bins.size(); i++) // start with bin corresponding to one gene
+        coding += bins[i];
+      pop_stats.neutral_sites.emplace_back(bins[0]);
+      pop_stats.one_gene_sites.emplace_back(bins[1]);
+      pop_stats.multi_gene_sites.emplace_back(coding - bins[1]);
+      pop_stats.coding_sites.emplace_back(coding);
+      pop_stats.gene_len.emplace_back(bins[0] + coding);
+      pop_stats.avg_overlap.emplace_back(org->GetAvgOverlap());
+      pop_stats.avg_num_neighbors.emplace_back(emp::Mean(org->GetGeneNeighbors()));
+    }
+    return pop_stats;
   }
 
   // sets up data tracking nodes for general statistics about population
   void SetStatsFile()
   {
-    emp::DataFile & gene_stats_file = SetupFile(data_filepath + "gene_stats.csv");
+    emp::DataFile & gene_stats_file = SetupDataFile(data_filepath + "gene_stats.csv");
     gene_stats_file.AddVar(update, "update", "update of current gen"); // tracks which update stats calc on
 
+    // every node pulls its column from one shared sweep of the population
     // data node to track number of neutral sites
     // num neutral sites is the size of 0 bin for each org
     auto & neutral_node = manager.New("neutral_sites");
-    neutral_node.AddPullSet([this]() {
-      emp::vector<double> pop_neut;
-      for (emp::Ptr<AagosOrg> org : pop)
-      {
-        if (!org)
-          continue;
-        pop_neut.emplace_back(org->GetHistogram().GetHistCount(0));
-      }
-      return pop_neut;
-    });
+    neutral_node.AddPullSet([this]() { return CollectPopStats().neutral_sites; });
 
     // data node to track number of single gene sites
     // size of 1 bin for each org
     auto & one_gene_node = manager.New("one_gene_sites");
-    one_gene_node.AddPullSet([this]() {
-      emp::vector<double> pop_one;
-      for (emp::Ptr<AagosOrg> org : pop)
-      {
-        if (!org)
-          continue;
-        pop_one.emplace_back(org->GetHistogram().GetHistCount(1));
-      }
-      return pop_one;
-    });
+    one_gene_node.AddPullSet([this]() { return CollectPopStats().one_gene_sites; });
 
     // node to track number of multiple overlap sites
     // all bins of size > 1
     auto & multi_gene_node = manager.New("multi_gene_sites");
-    multi_gene_node.AddPullSet([this]() {
-      emp::vector<double> pop_multi;
-      for (emp::Ptr<AagosOrg> org : pop)
-      {
-        if (!org)
-          continue;
-        int count = 0;
-        const emp::vector<size_t> &bins = org->GetHistogram().GetHistCounts(); // get all bins
-        for (size_t i = 2; i < bins.size(); i++)                              // check all bins that are > 1
-        {
-          count += bins[i]; // assuming bins are in order, sum all bins
-        }
-        pop_multi.emplace_back(count);
-      }
-      return pop_multi;
-    });
-  // node to track the number of sites with at least one gene corresponding to it
-  auto & coding_sites_node = manager.New("coding_sites");
-  coding_sites_node.AddPullSet([this]() {
-    emp::vector<double> pop_coding;
-    for ( emp::Ptr<AagosOrg> org : pop) 
-    {
-      if (!org)
-        continue;
-      int count = 0;
-      const emp::vector<size_t> &bins = org->GetHistogram().GetHistCounts();
-      for (size_t i = 1; i < bins.size(); i++) // start with bin corresponding to one gene
-      {
-        count += bins[i]; // sum all bin counts
-      }
-      pop_coding.emplace_back(count);
-    }
-    return pop_coding;
-  });
-  // node to track the gene length of each organism
-  auto & gene_len_node = manager.New("gene_len");
-  gene_len_node.AddPullSet([this]() {
-        emp::vector<double> pop_len;
-    for ( emp::Ptr<AagosOrg> org : pop) 
-    {
-      if (!org)
-        continue;
-      int count = 0;
-      const emp::vector<size_t> &bins = org->GetHistogram().GetHistCounts();
-      for (size_t i = 0; i < bins.size(); i++) // start with bin corresponding to no gene
-      {
-        count += bins[i]; // sum all bin counts
-      }
-      pop_len.emplace_back(count);
-    }
-    return pop_len;
-  });
+    multi_gene_node.AddPullSet([this]() { return CollectPopStats().multi_gene_sites; });
+
+    // node to track the number of sites with at least one gene corresponding to it
+    auto & coding_sites_node = manager.New("coding_sites");
+    coding_sites_node.AddPullSet([this]() { return CollectPopStats().coding_sites; });
+
+    // node to track the gene length of each organism
+    auto & gene_len_node = manager.New("gene_len");
+    gene_len_node.AddPullSet([this]() { return CollectPopStats().gene_len; });
+
     // avg overlap is average number of genes per site
     // measure amount of overlap in a genome
     // calculated as mean of histogram
     auto & overlap_node = manager.New("avg_overlap");
-    overlap_node.AddPullSet([this]() { 
-      emp::vector<double> pop_overlap;
-      for (emp::Ptr<AagosOrg> org : pop)
-      {
-        if (!org)
-          continue;
-        pop_overlap.emplace_back(org->GetHistogram().GetMean());
-      }
-      return pop_overlap;
-    });
-
-    
+    overlap_node.AddPullSet([this]() { return CollectPopStats().avg_overlap; });
 
     // neighbor node gets mean of gene neighbors for each org
     auto & neighbor_node = manager.New("avg_num_neighbors");
-    neighbor_node.AddPullSet([this]() {
-      emp::vector<double> pop_neighbor;
-      for (emp::Ptr<AagosOrg> org : pop)
-      {
-        if (!org)
-          continue;
-        pop_neighbor.emplace_back(emp::Mean(org->GetGeneNeighbors()));
-      }
-      return pop_neighbor;
-    });
+    neighbor_node.AddPullSet([this]() { return CollectPopStats().avg_num_neighbors; });
 
     // add all data nodes to stats data file
     gene_stats_file.AddStats(neutral_node, "neutral_sites", "sites with no genes associated with them", true, true);
@@ -415,7 +1315,7 @@ public:
   void SetRepresentativeFile()
   {
 
-    emp::DataFile & representative_file = SetupFile( data_filepath + "representative_org.csv");
+    emp::DataFile & representative_file = SetupDataFile( data_filepath + "representative_org.csv");
     representative_file.AddVar(update, "update", "update of current gen");
 
     // function param to add_fun in data node is a std::fn, not a lambda fn
@@ -429,7 +1329,7 @@ public:
       // fn for current bin of histogram
       gene_overlap_fun = [this, b]() {
         FindFittest(); // since order not guaranteed, must look for fittest ind. in each fn call
-        return pop[(size_t)fittest_id]->GetHistogram().GetHistCount(b);
+        return pop[(size_t)fittest_id]->GetHistCount(b);
       };
       // add current function to file
       representative_file.AddFun(gene_overlap_fun, "gene_overlap_" + emp::to_string(b), "statistics for representative population member");
@@ -446,7 +1346,7 @@ public:
     // gets number of coding sites for representative org
     std::function<double()> coding_sites_fun = [this]() {
         FindFittest();
-        const emp::vector<size_t> &bins = pop[(size_t)fittest_id]->GetHistogram().GetHistCounts();
+        const emp::vector<size_t> &bins = pop[(size_t)fittest_id]->GetHistCounts();
         int count = 0;
         for (size_t i = 1; i < bins.size(); i++) // start with bin corresponding to one gene
           {
@@ -489,14 +1389,22 @@ public:
   // aggregates all snapshot orgsi into a csv separated by col
   void SetSnapshotFile()
   {
+    // binary snapshots are written by Update, from the population snapshot.csv would get.
+    // Resumed runs open the file in LoadCheckpoint, once they know where to continue it
+    if (config.BINARY_SNAPSHOT())
+    {
+      if (config.RESUME() == "")
+        binary_snapshot_file.New(data_filepath + "snapshot.bin", num_genes, gene_size, num_bins, 0, async_writer.get());
+      return;
+    }
 
     // fn that gets all valid orgs for snapshot
     std::function<emp::vector<emp::Ptr<AagosOrg>>()> snapshot_fun = [this]() {
       return GetValidOrgs(GetValidOrgIDs()); // gets ids of all valid orgs
     };
     //create snapshot file
-    auto temp_file = emp::MakeContainerDataFile(snapshot_fun, data_filepath + "snapshot.csv");
-    snapshot_file.New(temp_file);
+    snapshot_file.New(OpenDataStream(data_filepath + "snapshot.csv"));
+    snapshot_file->SetUpdateContainerFun(snapshot_fun);
     // lists which update file created on
     snapshot_file->AddVar(update, "update", "update of current gen");
 
@@ -506,7 +1414,7 @@ public:
     for (size_t b = 0; b < num_bins; b++) // loop through each bin of hist & get val of bin
     {
       snap_gene_overlap_fun = [this, b](emp::Ptr<AagosOrg> org) {
-        return org->GetHistogram().GetHistCount(b);
+        return org->GetHistCount(b);
       };
       // add fn for each bin to file
       snapshot_file->AddContainerFun(snap_gene_overlap_fun, emp::to_string(b) + "_gene_overlap_frequency",
@@ -552,23 +1460,329 @@ public:
   // updates world
   void Update()
   {
-    // do environmental change
-    if(gradient) {
-      for(size_t i = 0; i < config.CHANGE_RATE(); i++) {
-        auto &rand = GetRandom();
-        // grad a randomly chosen target sequence and assign to a new randomly generated target sequence
-        auto & to_change = target_bits[rand.GetUInt(target_bits.size())];
-        auto rand_loc = rand.GetUInt(to_change.size());
-        to_change.Set(rand_loc, !to_change.Get(rand_loc)); // call set function on bitvector  call getBit on bitvector to flip
-        // random has a getUInt, and also use getUInt to get the bit within the bit vector
-        // bitvector.Set(i, !bitvector.Get(i))
-        // bitvector.Set(random->GetUInt(bitvector.size()), !bitvector.Get(i)) its okay b/c bit NEEDS TO FLIP for env change
+    {
+      auto timer = TimePhase(AagosPerf::ENVIRONMENT);
+      // do environmental change, noting each gene it touches
+      changed_genes.resize(0);
+      if(gradient) {
+        for(size_t i = 0; i < config.CHANGE_RATE(); i++) {
+          auto &rand = GetRandom();
+          // grad a randomly chosen target sequence and assign to a new randomly generated target sequence
+          const size_t gene_id = rand.GetUInt(target_bits.size());
+          auto rand_loc = rand.GetUInt(gene_size);
+          target_bits[gene_id] ^= (uint32_t)1 << rand_loc; // bit NEEDS TO FLIP for env change
+          changed_genes.push_back(gene_id);
+        }
+      } else if (hashed) {
+        // a redrawn state hashes to a new fitness, so no fitness needs drawing
+        for(size_t i = 0; i < config.CHANGE_RATE(); i++) {
+          auto &rand = GetRandom();
+          const size_t gene_id = rand.GetUInt(num_genes);
+          const size_t state = rand.GetUInt(hashed_landscape.GetStateCount());
+          hashed_landscape.Redraw(gene_id, state);
+          changed_genes.push_back(gene_id);
+        }
+      } else { // default
+        // draws gene, then state, then value, in an order fixed here on purpose so
+        // just the changed entry of nk_table is patched. Runs differ from earlier
+        // builds, which left the draws to NKLandscape
+        const size_t num_states = landscape.GetStateCount();
+        for(size_t i = 0; i < config.CHANGE_RATE(); i++) {
+          auto &rand = GetRandom();
+          const size_t gene_id = rand.GetUInt(num_genes);
+          const size_t state = rand.GetUInt(num_states);
+          const double state_fitness = rand.GetDouble();
+          if (num_envs == 1) // cyclic runs keep every environment in a table
+            landscape.SetState(gene_id, state, state_fitness);
+          if (nk_table.size())
+            nk_table[gene_id * num_states + state] = state_fitness;
+          changed_genes.push_back(gene_id);
+        }
       }
-    } else { // default
-      landscape.RandomizeStates(GetRandom(), config.CHANGE_RATE());
+      std::sort(changed_genes.begin(), changed_genes.end());
+      changed_genes.erase(std::unique(changed_genes.begin(), changed_genes.end()), changed_genes.end());
+    }
+    // cached fitness is stale once the environment changes
+    if (config.CHANGE_RATE() > 0)
+    {
+      env_epoch++;
+      changed_epoch = env_epoch;
+      if (num_threads > 1)
+      {
+        auto timer = TimePhase(AagosPerf::FITNESS);
+        EvaluateFitness();
+      }
+    }
+
+    const size_t stats_calcs = AagosOrg::NumStatsCalcs();
+    {
+      auto timer = TimePhase(AagosPerf::OUTPUT);
+      // rows are written alongside the data files, which base update writes before moving on
+      if (output_out && output_spec.IsOutputUpdate(update))
+        WriteOutputRow();
+      // same update and population as snapshot.csv, which base update writes next
+      if (binary_snapshot_file && update % config.SNAPSHOT_INTERVAL() == 0)
+        WriteBinarySnapshot(update);
+      base_t::Update();
+    }
+    // data files above saw the population selection picked from
+    if (selected_ids.size())
+    {
+      auto timer = TimePhase(AagosPerf::SELECTION);
+      PlaceNextGeneration();
+    }
+    // cyclic runs move on to the environment of the update about to start
+    if (EnvironmentForUpdate(update) != env_id)
+    {
+      auto timer = TimePhase(AagosPerf::ENVIRONMENT);
+      SwitchEnvironment(EnvironmentForUpdate(update));
+    }
+    {
+      auto timer = TimePhase(AagosPerf::OUTPUT);
+      // checkpoint once everything for the update just finished has been written
+      if (config.CHECKPOINT_INTERVAL() && update % config.CHECKPOINT_INTERVAL() == 0)
+        SaveCheckpoint(data_filepath + "checkpoint.bin");
     }
-    base_t::Update();
     fittest_id = -1; // reset fittest id flag
+
+    if (perf)
+    {
+      perf->stats_calcs += AagosOrg::NumStatsCalcs() - stats_calcs;
+      perf->num_updates++;
+      if ((update - 1) % config.STATISTICS_INTERVAL() == 0)
+        WritePerfStats(update - 1);
+    }
+  }
+
+  // writes a row of perf.csv covering everything since the last row
+  void WritePerfStats(size_t stats_update)
+  {
+    // total size of the data files so far, as far as they have reached disk
+    size_t data_bytes = 0;
+    for (const char *name : {"fitness.csv", "gene_stats.csv", "representative_org.csv", "output.csv", "snapshot.csv", "snapshot.bin"})
+    {
+      struct stat file_stat;
+      if (stat((data_filepath + name).c_str(), &file_stat) == 0)
+        data_bytes += (size_t)file_stat.st_size;
+    }
+    perf->WriteRow(*perf_out, stats_update, data_bytes);
+  }
+
+  // writes all valid orgs of current population to binary snapshot file
+  void WriteBinarySnapshot(size_t snapshot_update)
+  {
+    emp::vector<emp::Ptr<AagosOrg>> orgs = GetValidOrgs(GetValidOrgIDs());
+    emp::vector<double> fitness;
+    fitness.reserve(orgs.size());
+    for (emp::Ptr<AagosOrg> org : orgs)
+      fitness.push_back(CalcFitnessOrg(*org));
+    binary_snapshot_file->Write(snapshot_update, orgs, fitness);
+  }
+
+  // saves everything needed to continue the run from the current update
+  // bit-for-bit: population, environment, random number generators and the
+  // update counter. See AagosCheckpoint.h for the format. Returns false if
+  // the file couldn't be written
+  bool SaveCheckpoint(const std::string &filename)
+  {
+    // the file sizes recorded below have to be on disk before the checkpoint is
+    const emp::vector<size_t> data_bytes = GetDataStreamBytes();
+    emp::vector<unsigned char> data(AagosCheckpoint::MAGIC, AagosCheckpoint::MAGIC + 8);
+    AagosSnapshot::PutUInt(data, AagosCheckpoint::VERSION, 4);
+    AagosSnapshot::PutUInt(data, sizeof(emp::Random), 4);
+    AagosSnapshot::PutUInt(data, update, 8);
+    AagosSnapshot::PutUInt(data, num_genes, 4);
+    AagosSnapshot::PutUInt(data, gene_size, 4);
+    AagosSnapshot::PutUInt(data, gradient, 4);
+    AagosSnapshot::PutUInt(data, worker_randoms.size(), 4);
+    AagosSnapshot::PutUInt(data, num_envs, 4);
+    AagosCheckpoint::PutRandom(data, GetRandom());
+    for (const emp::Random &random : worker_randoms)
+      AagosCheckpoint::PutRandom(data, random);
+    AagosSnapshot::PutUInt(data, binary_snapshot_file ? binary_snapshot_file->GetBytesWritten() : 0, 8);
+    AagosSnapshot::PutUInt(data, data_bytes.size(), 4);
+    for (size_t bytes : data_bytes)
+      AagosSnapshot::PutUInt(data, bytes, 8);
+
+    for (size_t env = 0; env < num_envs; env++)
+    {
+      if (gradient)
+      {
+        for (uint32_t target : EnvTargets(env))
+          AagosSnapshot::PutUInt(data, target, 4);
+      }
+      else if (hashed)
+      {
+        // redrawn states in key order, so the same run always writes the same bytes
+        const AagosHashedLandscape &env_landscape = EnvHashedLandscape(env);
+        emp::vector<std::pair<uint64_t, uint32_t>> redraws(env_landscape.GetRedraws().begin(),
+                                                            env_landscape.GetRedraws().end());
+        std::sort(redraws.begin(), redraws.end());
+        AagosSnapshot::PutUInt(data, 0, 4);
+        AagosSnapshot::PutUInt(data, env_landscape.GetSeed(), 8);
+        AagosSnapshot::PutUInt(data, redraws.size(), 8);
+        for (const auto &redraw : redraws)
+        {
+          AagosSnapshot::PutUInt(data, AagosHashedLandscape::KeyGene(redraw.first), 4);
+          AagosSnapshot::PutUInt(data, AagosHashedLandscape::KeyState(redraw.first), 4);
+          AagosSnapshot::PutUInt(data, redraw.second, 4);
+        }
+      }
+      else
+      {
+        const size_t num_states = landscape.GetStateCount();
+        AagosSnapshot::PutUInt(data, num_states, 4);
+        for (size_t gene_id = 0; gene_id < num_genes; gene_id++)
+          for (size_t state = 0; state < num_states; state++)
+            AagosSnapshot::PutDouble(data, num_envs == 1 ? landscape.GetFitness(gene_id, state)
+                                                         : EnvNKTable(env)[gene_id * num_states + state]);
+      }
+    }
+
+    emp::vector<size_t> org_ids = GetValidOrgIDs();
+    AagosSnapshot::PutUInt(data, org_ids.size(), 4);
+    for (size_t id : org_ids)
+    {
+      const AagosGenome &bits = pop[id]->GetBits();
+      AagosSnapshot::PutUInt(data, bits.size(), 4);
+      for (size_t w = 0; w < AagosSnapshot::NumWords(bits.size()); w++)
+        AagosSnapshot::PutUInt(data, bits.GetUInt(w), 4);
+      for (size_t start : pop[id]->GetGeneStarts())
+        AagosSnapshot::PutUInt(data, start, 4);
+    }
+
+    AagosSnapshot::PutUInt(data, lineage_ids.size(), 4);
+    for (size_t id : lineage_ids)
+      AagosSnapshot::PutUInt(data, id, 4);
+    if (lineage_ids.size())
+      lineage.Save(data);
+
+    if (!AagosCheckpoint::WriteFile(filename, data))
+    {
+      std::cerr << "Unable to write checkpoint " << filename << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  // restores a run saved by SaveCheckpoint into this world, which must be empty
+  // and built with the same configuration. Returns false if the checkpoint
+  // can't be read or doesn't match the configuration
+  bool LoadCheckpoint(const std::string &filename)
+  {
+    emp_assert(GetSize() == 0, "checkpoints can only be loaded into an empty world");
+    emp::vector<unsigned char> data;
+    if (!AagosCheckpoint::ReadFile(filename, data))
+      return false;
+    AagosCheckpoint::Cursor in(data);
+    if (!in.GetMagic() || in.GetUInt(4) != AagosCheckpoint::VERSION || in.GetUInt(4) != sizeof(emp::Random))
+      return false;
+    const size_t saved_update = in.GetUInt(8);
+    if (in.GetUInt(4) != num_genes || in.GetUInt(4) != gene_size || in.GetUInt(4) != (uint64_t)gradient ||
+        in.GetUInt(4) != worker_randoms.size() || in.GetUInt(4) != num_envs)
+      return false;
+
+    // random number generators are restored last, so nothing below can draw from them
+    emp::Random saved_random(1);
+    in.GetRandom(saved_random);
+    emp::vector<emp::Random> saved_worker_randoms(worker_randoms);
+    for (emp::Random &random : saved_worker_randoms)
+      in.GetRandom(random);
+    const size_t snapshot_bytes = in.GetUInt(8);
+    emp::vector<size_t> data_bytes(in.GetUInt(4));
+    if (data_bytes.size() != data_streams.size())
+      return false;
+    for (size_t &bytes : data_bytes)
+      bytes = in.GetUInt(8);
+
+    for (size_t env = 0; env < num_envs; env++)
+    {
+      if (gradient)
+      {
+        for (uint32_t &target : EnvTargets(env))
+          target = (uint32_t)in.GetUInt(4);
+      }
+      else if (hashed)
+      {
+        if (in.GetUInt(4) != 0)
+          return false;
+        AagosHashedLandscape &env_landscape = EnvHashedLandscape(env);
+        env_landscape = AagosHashedLandscape(in.GetUInt(8), num_genes, gene_size);
+        const size_t num_redraws = in.GetUInt(8);
+        for (size_t i = 0; i < num_redraws && in.IsOk(); i++)
+        {
+          const size_t gene_id = in.GetUInt(4);
+          const size_t state = in.GetUInt(4);
+          const uint32_t count = (uint32_t)in.GetUInt(4);
+          if (gene_id >= num_genes || state >= env_landscape.GetStateCount() || count == 0)
+            return false;
+          env_landscape.SetRedraws(gene_id, state, count);
+        }
+      }
+      else
+      {
+        const size_t num_states = landscape.GetStateCount();
+        if (in.GetUInt(4) != num_states)
+          return false;
+        for (size_t gene_id = 0; gene_id < num_genes; gene_id++)
+        {
+          for (size_t state = 0; state < num_states; state++)
+          {
+            if (num_envs == 1)
+              landscape.SetState(gene_id, state, in.GetDouble());
+            else
+              EnvNKTable(env)[gene_id * num_states + state] = in.GetDouble();
+          }
+        }
+        if (num_envs == 1 && nk_table.size())
+          RefreshNKTable();
+      }
+    }
+
+    const size_t num_orgs = in.GetUInt(4);
+    if (!in.IsOk() || num_orgs != config.POP_SIZE())
+      return false;
+    for (size_t i = 0; i < num_orgs; i++)
+    {
+      const size_t genome_size = in.GetUInt(4);
+      if (genome_size < config.MIN_SIZE() || genome_size > config.MAX_SIZE())
+        return false;
+      AagosOrg org(genome_size, num_genes, gene_size, genome_pool);
+      for (size_t w = 0; w < AagosSnapshot::NumWords(genome_size); w++)
+        org.bits.SetUInt(w, (uint32_t)in.GetUInt(4));
+      for (size_t &start : org.gene_starts.Mutable())
+      {
+        start = in.GetUInt(4);
+        if (start >= genome_size)
+          return false;
+      }
+      if (!in.IsOk())
+        return false;
+      Inject(org);
+    }
+
+    // ancestry carries on from the checkpoint's, so lineage.csv reaches back to the start of the run
+    const size_t num_lineage_ids = in.GetUInt(4);
+    if (num_lineage_ids && (num_lineage_ids != num_orgs || !lineage_tracking))
+      return false;
+    lineage_ids.resize(num_lineage_ids);
+    for (size_t &id : lineage_ids)
+      id = in.GetUInt(4);
+    if (lineage_ids.size() && !lineage.Load(in))
+      return false;
+    if (!in.IsOk())
+      return false;
+
+    GetRandom() = saved_random;
+    worker_randoms = saved_worker_randoms;
+    update = saved_update;
+    env_epoch++; // any fitness cached under the original environment is stale
+    SwitchEnvironment(EnvironmentForUpdate(update));
+    if (config.BINARY_SNAPSHOT())
+      binary_snapshot_file.New(data_filepath + "snapshot.bin", num_genes, gene_size, num_bins, snapshot_bytes,
+                               async_writer.get());
+    ResumeDataStreams(data_bytes);
+    return true;
   }
 };
 
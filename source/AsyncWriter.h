@@ -0,0 +1,185 @@
+#ifndef ASYNC_WRITER_H
+#define ASYNC_WRITER_H
+
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+
+#include "base/vector.h"
+
+// Appends chunks of output to files from a background thread, so the thread
+// producing output only waits on the filesystem when the queue is full.
+// Chunks for the same file are written in the order they were queued.
+class AsyncWriter
+{
+private:
+  struct Chunk
+  {
+    std::ofstream *file;
+    std::string data;
+  };
+
+  // only touched by the thread that owns the writer; the background thread
+  // just gets the file pointers carried by each chunk
+  emp::vector<std::unique_ptr<std::ofstream>> files;
+  std::deque<Chunk> queue;
+  size_t max_chunks;
+  std::mutex mutex;
+  std::condition_variable chunk_ready;
+  std::condition_variable chunk_done;
+  bool writing; // background thread is writing a chunk it took off the queue
+  bool stopping;
+  std::thread thread;
+
+  void WriterLoop()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+      chunk_ready.wait(lock, [this]() { return stopping || queue.size(); });
+      if (queue.empty())
+        return;
+      Chunk chunk = std::move(queue.front());
+      queue.pop_front();
+      writing = true;
+      chunk_done.notify_all(); // room in queue
+      lock.unlock();
+      chunk.file->write(chunk.data.data(), (std::streamsize)chunk.data.size());
+      chunk.file->flush();
+      lock.lock();
+      writing = false;
+      chunk_done.notify_all();
+    }
+  }
+
+public:
+  AsyncWriter(size_t _max_chunks = 64)
+      : files()
+      , queue()
+      , max_chunks(_max_chunks)
+      , mutex()
+      , chunk_ready()
+      , chunk_done()
+      , writing(false)
+      , stopping(false)
+      , thread()
+  {
+    emp_assert(max_chunks > 0, max_chunks);
+    thread = std::thread(&AsyncWriter::WriterLoop, this);
+  }
+
+  AsyncWriter(const AsyncWriter &) = delete;
+  AsyncWriter &operator=(const AsyncWriter &) = delete;
+
+  // writes out everything still queued before stopping
+  ~AsyncWriter()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    chunk_ready.notify_one();
+    thread.join();
+  }
+
+  // opens a file for later writes and returns its id
+  size_t OpenFile(const std::string &filename, std::ios::openmode mode = std::ios::out)
+  {
+    files.emplace_back(new std::ofstream(filename, mode));
+    return files.size() - 1;
+  }
+
+  // queues data to be appended to a file, waiting first if the queue is full
+  void Write(size_t file_id, std::string &&data)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    chunk_done.wait(lock, [this]() { return queue.size() < max_chunks; });
+    queue.push_back(Chunk{files[file_id].get(), std::move(data)});
+    chunk_ready.notify_one();
+  }
+
+  // waits until everything queued so far is written and flushed
+  void Flush()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    chunk_done.wait(lock, [this]() { return queue.empty() && !writing; });
+  }
+};
+
+// Output stream for one file of an AsyncWriter. Text collects in memory and is
+// handed to the writer on each flush, or sooner once it grows past chunk_bytes
+class AsyncOStream : public std::ostream
+{
+private:
+  class Buffer : public std::streambuf
+  {
+  private:
+    AsyncWriter &writer;
+    size_t file_id;
+    size_t chunk_bytes;
+    std::string data;
+
+    void Send()
+    {
+      if (data.size())
+        writer.Write(file_id, std::move(data));
+      data.clear();
+    }
+
+  protected:
+    int_type overflow(int_type c) override
+    {
+      if (!traits_type::eq_int_type(c, traits_type::eof()))
+      {
+        data.push_back(traits_type::to_char_type(c));
+        if (data.size() >= chunk_bytes)
+          Send();
+      }
+      return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char *s, std::streamsize n) override
+    {
+      data.append(s, (size_t)n);
+      if (data.size() >= chunk_bytes)
+        Send();
+      return n;
+    }
+
+    int sync() override
+    {
+      Send();
+      return 0;
+    }
+
+  public:
+    Buffer(AsyncWriter &_writer, size_t _file_id, size_t _chunk_bytes)
+        : writer(_writer)
+        , file_id(_file_id)
+        , chunk_bytes(_chunk_bytes)
+        , data()
+    {
+    }
+  };
+
+  Buffer buffer;
+
+public:
+  AsyncOStream(AsyncWriter &writer, const std::string &filename, std::ios::openmode mode = std::ios::out,
+               size_t chunk_bytes = 1 << 16)
+      : std::ostream(nullptr)
+      , buffer(writer, writer.OpenFile(filename, mode), chunk_bytes)
+  {
+    rdbuf(&buffer);
+  }
+
+  ~AsyncOStream() { flush(); }
+};
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef COW_PTR_H
+#define COW_PTR_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+#include "base/assert.h"
+
+// Copy-on-write value: copies share one value until a copy asks to change it,
+// at which point that copy alone gets a value of its own. Different copies can
+// be read and changed on different threads, as long as copies are only made
+// while none of them are being changed
+template <typename T>
+class CowPtr
+{
+private:
+  struct Block
+  {
+    std::atomic<size_t> refs;
+    T value;
+
+    Block(const T &_value)
+        : refs(1)
+        , value(_value)
+    {
+    }
+  };
+
+  Block *block; // null until first used, and after being moved from
+
+  void Release()
+  {
+    // the last owner to let go sees every change made by the others
+    if (block && block->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      delete block;
+    block = nullptr;
+  }
+
+public:
+  CowPtr()
+      : block(nullptr)
+  {
+  }
+
+  explicit CowPtr(const T &value)
+      : block(new Block(value))
+  {
+  }
+
+  CowPtr(const CowPtr &other)
+      : block(other.block)
+  {
+    if (block)
+      block->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  CowPtr(CowPtr &&other)
+      : block(other.block)
+  {
+    other.block = nullptr;
+  }
+
+  ~CowPtr() { Release(); }
+
+  CowPtr &operator=(const CowPtr &other)
+  {
+    if (block != other.block)
+    {
+      if (other.block)
+        other.block->refs.fetch_add(1, std::memory_order_relaxed);
+      Release();
+      block = other.block;
+    }
+    return *this;
+  }
+
+  CowPtr &operator=(CowPtr &&other)
+  {
+    if (this != &other)
+    {
+      Release();
+      block = other.block;
+      other.block = nullptr;
+    }
+    return *this;
+  }
+
+  const T &Get() const
+  {
+    emp_assert(block, "CowPtr read before it was given a value");
+    return block->value;
+  }
+
+  // the value, copied first if any other copy still shares it
+  T &Mutable()
+  {
+    if (!block)
+      block = new Block(T());
+    else if (block->refs.load(std::memory_order_acquire) != 1)
+    {
+      Block *copy = new Block(block->value);
+      Release();
+      block = copy;
+    }
+    return block->value;
+  }
+
+  bool IsShared() const { return block && block->refs.load(std::memory_order_acquire) != 1; }
+};
+
+#endif
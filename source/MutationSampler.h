@@ -0,0 +1,76 @@
+#ifndef MUTATION_SAMPLER_H
+#define MUTATION_SAMPLER_H
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "tools/Binomial.h"
+#include "tools/Random.h"
+
+// Returns the binomial distribution for num_trials trials with success
+// probability prob. Each distribution is built the first time it is asked for
+// and then shared by every caller for the rest of the program.
+inline emp::Binomial &GetSharedBinomial(double prob, size_t num_trials)
+{
+  static std::mutex mutex;
+  static std::map<std::pair<double, size_t>, std::unique_ptr<emp::Binomial>> binomials;
+  std::lock_guard<std::mutex> lock(mutex);
+  auto &binomial = binomials[std::make_pair(prob, num_trials)];
+  if (!binomial)
+  {
+    binomial.reset(new emp::Binomial(prob, num_trials));
+    // the first draw finishes setting up the distribution's internal index,
+    // so do it here and leave later draws from any thread read only
+    emp::Random setup_random(1);
+    binomial->PickRandom(setup_random);
+  }
+  return *binomial;
+}
+
+// Picks how many sites of a genome mutate, for a fixed per-site probability and
+// any genome length in [min_size, max_size]. The distribution for a length is
+// only looked up the first time a genome of that length mutates, so lengths the
+// population never reaches cost nothing. Safe to share between threads.
+class MutationSampler
+{
+private:
+  double prob;
+  size_t min_size;
+  size_t max_size;
+  // distribution for each genome length, null until first used
+  std::unique_ptr<std::atomic<emp::Binomial *>[]> binomials;
+
+public:
+  MutationSampler(double _prob, size_t _min_size, size_t _max_size)
+      : prob(_prob)
+      , min_size(_min_size)
+      , max_size(_max_size)
+      , binomials(new std::atomic<emp::Binomial *>[_max_size - _min_size + 1])
+  {
+    emp_assert(min_size <= max_size, min_size, max_size);
+    for (size_t i = 0; i <= max_size - min_size; i++)
+      binomials[i].store(nullptr);
+  }
+
+  MutationSampler(const MutationSampler &) = delete;
+  MutationSampler &operator=(const MutationSampler &) = delete;
+
+  // number of mutations for a genome of num_sites sites
+  size_t PickRandom(emp::Random &random, size_t num_sites)
+  {
+    emp_assert(num_sites >= min_size && num_sites <= max_size, "no distribution for genomes of this size", num_sites);
+    std::atomic<emp::Binomial *> &slot = binomials[num_sites - min_size];
+    emp::Binomial *binomial = slot.load(std::memory_order_acquire);
+    if (!binomial)
+    { // racing threads all get the same shared distribution, so any store wins
+      binomial = &GetSharedBinomial(prob, num_sites);
+      slot.store(binomial, std::memory_order_release);
+    }
+    return binomial->PickRandom(random);
+  }
+};
+
+#endif
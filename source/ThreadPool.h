@@ -0,0 +1,125 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "base/vector.h"
+
+// Fixed set of worker threads that all run the same job together.
+// The calling thread takes part as worker 0, so a pool of size 1
+// starts no extra threads and just runs the job in place.
+class ThreadPool
+{
+private:
+  using job_t = std::function<void(size_t)>;
+
+  emp::vector<std::thread> threads;
+  std::mutex mutex;
+  std::condition_variable job_ready;
+  std::condition_variable job_done;
+  // job currently being run, only valid while a call to Run is active
+  const job_t *job;
+  // incremented for each job so waiting workers can tell a new one arrived
+  size_t job_count;
+  // number of helper threads still working on the current job
+  size_t num_running;
+  bool stopping;
+
+  void WorkerLoop(size_t worker_id)
+  {
+    size_t seen_jobs = 0;
+    while (true)
+    {
+      const job_t *cur_job = nullptr;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        job_ready.wait(lock, [this, seen_jobs]() { return stopping || job_count != seen_jobs; });
+        if (stopping)
+          return;
+        seen_jobs = job_count;
+        cur_job = job;
+      }
+      (*cur_job)(worker_id);
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--num_running == 0)
+          job_done.notify_one();
+      }
+    }
+  }
+
+public:
+  ThreadPool(size_t num_threads = 1)
+      : threads()
+      , mutex()
+      , job_ready()
+      , job_done()
+      , job(nullptr)
+      , job_count(0)
+      , num_running(0)
+      , stopping(false)
+  {
+    emp_assert(num_threads > 0, num_threads);
+    for (size_t i = 1; i < num_threads; i++)
+    {
+      threads.emplace_back(&ThreadPool::WorkerLoop, this, i);
+    }
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    job_ready.notify_all();
+    for (auto &thread : threads)
+      thread.join();
+  }
+
+  // getter for number of workers, including the calling thread
+  size_t GetSize() const { return threads.size() + 1; }
+
+  // runs fun(worker_id) once on every worker and waits for all of them to finish
+  void Run(const job_t &fun)
+  {
+    if (threads.size())
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &fun;
+        num_running = threads.size();
+        job_count++;
+      }
+      job_ready.notify_all();
+    }
+    fun(0);
+    if (threads.size())
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      job_done.wait(lock, [this]() { return num_running == 0; });
+      job = nullptr;
+    }
+  }
+
+  // runs fun(task_id, worker_id) for every task_id below num_tasks and waits for
+  // all of them to finish. Idle workers claim the next unclaimed task, so tasks
+  // of uneven length keep every worker busy until the last ones are handed out
+  void RunTasks(size_t num_tasks, const std::function<void(size_t, size_t)> &fun)
+  {
+    std::atomic<size_t> next_task(0);
+    Run([&next_task, num_tasks, &fun](size_t worker_id) {
+      for (size_t task_id = next_task++; task_id < num_tasks; task_id = next_task++)
+        fun(task_id, worker_id);
+    });
+  }
+};
+
+#endif
@@ -1,8 +1,10 @@
+#include <algorithm>
 #include <iostream>
 #include "base/vector.h"
 #include "config/ArgManager.h"
 #include "config/command_line.h"
 
+#include "../AagosIslands.h"
 #include "../AagosOrg.h"
 #include "../AagosWorld.h"
 
@@ -15,34 +17,62 @@ int main(int argc, char* argv[])
   if (args.ProcessConfigOptions(config, std::cout, "Aagos.cfg", "Aagos-macros.h") == false) exit(0);
   if (args.TestUnknown() == false) exit(0);  // If there are leftover args, throw an error.
   config.Write(std::cout);
-auto rand = emp::Random(config.SEED());
-  AagosWorld world(rand, config);
 
-  emp::Random & random = world.GetRandom();
+  if (config.NUM_DEMES() > 1) {
+    // island model, with each deme writing to its own directory under DATA_FILEPATH
+    AagosIslands islands(config);
+    if (config.RESUME() != "") {
+      // RESUME is the DATA_FILEPATH of the stopped run, holding the manifest of its last checkpoint
+      if (!islands.LoadCheckpoints(config.RESUME())) {
+        std::cout << "Unable to resume from checkpoints in " << config.RESUME() << std::endl;
+        exit(1);
+      }
+    } else {
+      islands.InitPopulation();
+    }
+
+    // runs through each generation to print, then prints the first org of each deme
+    for (size_t gen = islands.GetUpdate(); gen <= config.MAX_GENS();) {
+      const size_t print_gen = (gen + config.PRINT_INTERVAL() - 1) / config.PRINT_INTERVAL() * config.PRINT_INTERVAL();
+      const size_t last_gen = std::min(print_gen, config.MAX_GENS());
+      islands.Run(last_gen - gen + 1);
+      if (last_gen % config.PRINT_INTERVAL() == 0) {
+        for (size_t k = 0; k < islands.GetNumDemes(); k++) {
+          std::cout << last_gen << " : deme=" << k
+                    << " fitness=" << islands.GetDeme(k).CalcFitnessID(0)
+                    << " size=" << islands.GetDeme(k)[0].GetNumBits()
+                    << std::endl;
+        }
+      }
+      gen = last_gen + 1;
+    }
 
-   // Build a random initial population
-  for (uint32_t i = 0; i < config.POP_SIZE(); i++) {
-    AagosOrg next_org(config.NUM_BITS(), config.NUM_GENES(), config.GENE_SIZE()); // build org
-    next_org.Randomize(random); // randomize org
-    world.Inject(next_org);     // inject org
+    for (size_t k = 0; k < islands.GetNumDemes(); k++)
+      islands.GetDeme(k).WriteLineage();
+    return 0;
   }
 
-  // runs each generation
-  for (size_t gen = 0; gen <= config.MAX_GENS(); gen++) {
-    // Do mutations on the population.
-    world.DoMutations(config.ELITE_COUNT());
-
-    // Keep the best individual.
-    if (config.ELITE_COUNT()) emp::EliteSelect(world, config.ELITE_COUNT(), 1);
+auto rand = emp::Random(config.SEED());
+  AagosWorld world(rand, config);
 
-    // Run a tournament for the rest...
-    emp::TournamentSelect(world, config.TOURNAMENT_SIZE(), config.POP_SIZE()-config.ELITE_COUNT());
+  if (config.RESUME() != "") {
+    // RESUME is the DATA_FILEPATH of the stopped run, holding its last checkpoint
+    if (!world.LoadCheckpoint(config.RESUME() + "checkpoint.bin")) {
+      std::cout << "Unable to resume from checkpoint " << config.RESUME() << "checkpoint.bin" << std::endl;
+      exit(1);
+    }
+  } else {
+    // Build a random initial population
+    world.InitPopulation();
+  }
 
-    // Update world
-    world.Update();
+  // runs each generation, continuing from the checkpointed update when resuming
+  for (size_t gen = world.GetUpdate(); gen <= config.MAX_GENS(); gen++) {
+    world.RunUpdate();
 
     // If it's a generation to print to console, do so
     if (gen % config.PRINT_INTERVAL() == 0) {
+      auto timer = world.TimePhase(AagosPerf::OUTPUT);
       std::cout << gen
                 << " : fitness=" << world.CalcFitnessID(0)
                 << " size=" << world[0].GetNumBits()
@@ -50,4 +80,7 @@ auto rand = emp::Random(config.SEED());
       world[0].Print();
     }
   }
+
+  // line of descent of the fittest org, when tracking lineage
+  world.WriteLineage();
 }
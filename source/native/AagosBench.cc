@@ -0,0 +1,148 @@
+// Times the hot paths of Aagos across genome sizes, gene layouts and mutation
+// rates, and writes one csv row per kernel and setting so runs can be compared
+// between commits.
+//
+//   ./AagosBench [results.csv] [label]
+//
+// Results default to bench.csv. The label (e.g. a commit hash) is copied into
+// every row. Scratch data files go to bench_data/, which is created if needed.
+// Each kernel is repeated until it has run for at least MIN_SECONDS, and the
+// reported time is the average per organism.
+
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <sys/stat.h>
+
+#include "base/Ptr.h"
+#include "base/vector.h"
+#include "tools/string_utils.h"
+
+#include "../AagosOrg.h"
+#include "../AagosSnapshot.h"
+#include "../AagosWorld.h"
+
+constexpr double MIN_SECONDS = 0.25;
+constexpr size_t MIN_REPS = 3;
+constexpr size_t POP_SIZE = 1000;
+
+// genome settings benchmarked, crossed with each mutation rate
+struct BenchSetting
+{
+  size_t num_bits;
+  size_t num_genes;
+  size_t gene_size;
+};
+
+// runs fun until MIN_SECONDS have passed, returning the number of runs and the seconds they took
+std::pair<size_t, double> TimeReps(const std::function<void()> &fun)
+{
+  using clock_t = std::chrono::steady_clock;
+  const auto start = clock_t::now();
+  size_t reps = 0;
+  double seconds = 0.0;
+  while (reps < MIN_REPS || seconds < MIN_SECONDS)
+  {
+    fun();
+    reps++;
+    seconds = std::chrono::duration<double>(clock_t::now() - start).count();
+  }
+  return std::make_pair(reps, seconds);
+}
+
+int main(int argc, char* argv[])
+{
+  const std::string results_filename = argc > 1 ? argv[1] : "bench.csv";
+  const std::string label = argc > 2 ? argv[2] : "";
+  const std::string data_filepath = "bench_data/";
+  mkdir(data_filepath.c_str(), 0755);
+
+  const emp::vector<BenchSetting> settings = {
+    {128, 16, 8}, {128, 16, 4}, {512, 16, 8}, {512, 32, 8}, {1024, 64, 16},
+  };
+  const emp::vector<double> mut_rates = {0.001, 0.01};
+
+  std::ofstream results(results_filename);
+  results << "label,kernel,num_bits,num_genes,gene_size,mut_rate,pop_size,reps,ns_per_org" << std::endl;
+
+  for (const BenchSetting &setting : settings) {
+    for (double mut_rate : mut_rates) {
+      AagosConfig config;
+      config.POP_SIZE(POP_SIZE);
+      config.NUM_BITS(setting.num_bits);
+      config.NUM_GENES(setting.num_genes);
+      config.GENE_SIZE(setting.gene_size);
+      config.MIN_SIZE(setting.gene_size);
+      config.MAX_SIZE(setting.num_bits * 2);
+      config.BIT_FLIP_PROB(mut_rate);
+      config.BIT_INS_PROB(mut_rate);
+      config.BIT_DEL_PROB(mut_rate);
+      config.GENE_MOVE_PROB(mut_rate);
+      config.CHANGE_RATE(0);
+      config.SEED(1);
+      // only headers are written, so data files don't skew the timings
+      config.STATISTICS_INTERVAL((size_t)-1);
+      config.SNAPSHOT_INTERVAL((size_t)-1);
+      config.DATA_FILEPATH(data_filepath);
+
+      emp::Random random(config.SEED());
+      AagosWorld world(random, config, "AagosBench");
+      world.InitPopulation();
+      emp::vector<emp::Ptr<AagosOrg>> orgs;
+
+      auto report = [&](const std::string &kernel, std::pair<size_t, double> timing) {
+        const double ns_per_org = timing.second * 1e9 / (double)(timing.first * POP_SIZE);
+        results << label << ',' << kernel << ',' << setting.num_bits << ',' << setting.num_genes << ','
+                << setting.gene_size << ',' << mut_rate << ',' << POP_SIZE << ',' << timing.first << ','
+                << ns_per_org << std::endl;
+        std::cout << kernel << " bits=" << setting.num_bits << " genes=" << setting.num_genes
+                  << " gene_size=" << setting.gene_size << " mut_rate=" << mut_rate
+                  << " : " << ns_per_org << " ns/org" << std::endl;
+      };
+
+      // fitness of every org, with cached fitness cleared first so each call scores the genome
+      double total_fitness = 0.0;
+      report("fit_fun", TimeReps([&]() {
+        for (size_t i = 0; i < world.GetSize(); i++) {
+          world[i].ResetFitness();
+          total_fitness += world.CalcFitnessID(i);
+        }
+      }));
+
+      // histogram and neighbors, each recalculated from scratch
+      report("HistogramCalc", TimeReps([&]() {
+        for (size_t i = 0; i < world.GetSize(); i++)
+          world[i].HistogramCalc((int)world[i].GetNumBits());
+      }));
+      report("NeighborCalc", TimeReps([&]() {
+        for (size_t i = 0; i < world.GetSize(); i++)
+          world[i].NeighborCalc((int)world[i].GetNumBits());
+      }));
+
+      // one round of tournament selection, including the update that installs the new generation
+      report("selection", TimeReps([&]() {
+        world.SelectNextGeneration(0, config.TOURNAMENT_SIZE(), config.POP_SIZE());
+        world.Update();
+      }));
+
+      // binary snapshot of the whole population
+      AagosSnapshotWriter snapshot_writer(data_filepath + "snapshot.bin", setting.num_genes, setting.gene_size,
+                                          setting.num_genes + 1);
+      emp::vector<double> fitness;
+      for (size_t i = 0; i < world.GetSize(); i++) {
+        orgs.push_back(emp::Ptr<AagosOrg>(&world[i]));
+        fitness.push_back(world.CalcFitnessID(i));
+      }
+      report("snapshot", TimeReps([&]() { snapshot_writer.Write(world.GetUpdate(), orgs, fitness); }));
+
+      // mutations last, since they change the genomes the other kernels were timed on
+      report("mut_fun", TimeReps([&]() { world.DoMutations(); }));
+
+      // keeps the fitness loop from being optimized away
+      if (total_fitness < 0.0) std::cout << total_fitness << std::endl;
+    }
+  }
+  std::cout << "Results written to " << results_filename << std::endl;
+}
@@ -0,0 +1,154 @@
+// Runs a grid of parameter values, with a number of replicates of each, in a
+// single process. Runs are spread across a pool of worker threads.
+//
+//   ./AagosSweep -REPLICATES 10 -SWEEP_THREADS 8 -SWEEP BIT_FLIP_PROB 0,0.001,0.01 -SWEEP CHANGE_RATE 0,10 [-NAME value ...]
+//
+// Settings that aren't swept come from Aagos.cfg and any -NAME value pairs, just
+// like Aagos. Replicate r of every combination is seeded with SEED + r (SEED of
+// 0 is first replaced by the time). Each run writes its data files and its full
+// config to a directory of its own under DATA_FILEPATH, named after its swept
+// values and replicate, e.g. BIT_FLIP_PROB_0.01__CHANGE_RATE_10__rep_3/
+
+#include <algorithm>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <utility>
+
+#include "base/Ptr.h"
+#include "base/vector.h"
+#include "tools/string_utils.h"
+
+#include "../AagosOrg.h"
+#include "../AagosWorld.h"
+#include "../ThreadPool.h"
+
+using setting_t = std::pair<std::string, std::string>;
+
+// a single world to run, with the config values that differ from the base config
+struct SweepRun
+{
+  std::string name;
+  emp::vector<setting_t> settings;
+};
+
+int main(int argc, char* argv[])
+{
+  size_t num_replicates = 1;
+  size_t num_workers = std::max(std::thread::hardware_concurrency(), 1u);
+  emp::vector<setting_t> base_settings;                                     // -NAME value pairs
+  emp::vector<std::pair<std::string, emp::vector<std::string>>> sweeps;     // -SWEEP NAME values
+
+  AagosConfig base_config;
+  base_config.Read("Aagos.cfg");
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg == "-SWEEP" && i + 2 < argc) {
+      sweeps.emplace_back(argv[i + 1], emp::slice(argv[i + 2], ','));
+      i += 2;
+    } else if (arg == "-REPLICATES" && i + 1 < argc) {
+      num_replicates = std::stoul(argv[++i]);
+    } else if (arg == "-SWEEP_THREADS" && i + 1 < argc) {
+      num_workers = std::stoul(argv[++i]);
+    } else if (arg.size() > 1 && arg[0] == '-' && i + 1 < argc) {
+      base_settings.emplace_back(arg.substr(1), argv[++i]);
+    } else {
+      std::cout << "Unknown argument: " << arg << std::endl;
+      exit(1);
+    }
+  }
+  for (const setting_t &setting : base_settings) {
+    if (!base_config.Has(setting.first)) {
+      std::cout << "Unknown setting: " << setting.first << std::endl;
+      exit(1);
+    }
+    base_config.Set(setting.first, setting.second);
+  }
+  for (const auto &sweep : sweeps) {
+    if (!base_config.Has(sweep.first) || sweep.second.size() == 0) {
+      std::cout << "Unknown or empty sweep: " << sweep.first << std::endl;
+      exit(1);
+    }
+  }
+  if (num_replicates == 0 || num_workers == 0) {
+    std::cout << "REPLICATES and SWEEP_THREADS must be at least 1" << std::endl;
+    exit(1);
+  }
+  const std::string data_filepath = base_config.DATA_FILEPATH();
+  const int base_seed = base_config.SEED() ? base_config.SEED() : (int)time(nullptr);
+
+  // build every combination of swept values, with the first sweep varying slowest
+  emp::vector<SweepRun> combos(1);
+  for (const auto &sweep : sweeps) {
+    emp::vector<SweepRun> next_combos;
+    for (const SweepRun &combo : combos) {
+      for (const std::string &val : sweep.second) {
+        SweepRun next = combo;
+        next.name += (next.name.size() ? "__" : "") + sweep.first + "_" + val;
+        next.settings.emplace_back(sweep.first, val);
+        next_combos.push_back(next);
+      }
+    }
+    combos = next_combos;
+  }
+  emp::vector<SweepRun> runs;
+  for (const SweepRun &combo : combos) {
+    for (size_t rep = 0; rep < num_replicates; rep++) {
+      SweepRun run;
+      run.name = combo.name + (combo.name.size() ? "__" : "") + "rep_" + emp::to_string(rep);
+      // swept seeds come after, so they override the replicate seed
+      run.settings.emplace_back("SEED", emp::to_string(base_seed + (int)rep));
+      run.settings.insert(run.settings.end(), combo.settings.begin(), combo.settings.end());
+      run.settings.emplace_back("DATA_FILEPATH", data_filepath + run.name + "/");
+      runs.push_back(run);
+    }
+  }
+  std::cout << "Running " << runs.size() << " worlds on " << num_workers << " threads" << std::endl;
+
+  // Empirical registers world signals in global tables, so worlds are only built
+  // and torn down while holding setup_mutex. Worlds with the same mutation
+  // settings share one set of mutation tables, which worlds on other threads
+  // only read: every binomial in them has had the draw that finishes setting it
+  // up before it is handed out (see GetSharedBinomial)
+  std::mutex setup_mutex;
+  std::map<AagosMutationTables::key_t, std::shared_ptr<AagosMutationTables>> shared_tables;
+
+  ThreadPool pool(num_workers);
+  pool.RunTasks(runs.size(), [&](size_t run_id, size_t) {
+    const SweepRun &run = runs[run_id];
+    AagosConfig config;
+    emp::Ptr<emp::Random> random;
+    emp::Ptr<AagosWorld> world;
+    {
+      std::lock_guard<std::mutex> lock(setup_mutex);
+      config.Read("Aagos.cfg");
+      for (const setting_t &setting : base_settings) config.Set(setting.first, setting.second);
+      for (const setting_t &setting : run.settings) config.Set(setting.first, setting.second);
+      mkdir(config.DATA_FILEPATH().c_str(), 0755);
+      std::ofstream config_file(config.DATA_FILEPATH() + "Aagos.cfg");
+      config.Write(config_file);
+
+      auto &tables = shared_tables[AagosMutationTables::GetKey(config)];
+      if (!tables) tables = std::make_shared<AagosMutationTables>(config);
+      random.New(config.SEED());
+      world.New(*random, config, run.name, tables);
+      world->InitPopulation();
+    }
+
+    // runs each generation
+    for (size_t gen = 0; gen <= config.MAX_GENS(); gen++) {
+      world->RunUpdate();
+    }
+
+    std::lock_guard<std::mutex> lock(setup_mutex);
+    std::cout << "Finished " << run.name << " : fitness=" << world->CalcFitnessID(0) << std::endl;
+    world.Delete();
+    random.Delete();
+  });
+}
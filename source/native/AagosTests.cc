@@ -1,9 +1,16 @@
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
 
 #include "base/vector.h"
 #include "config/ArgManager.h"
 #include "config/command_line.h"
 
+#include "../AagosIslands.h"
 #include "../AagosOrg.h"
 #include "../AagosWorld.h"
 
@@ -20,6 +27,129 @@ int main(int argc, char* argv[])
   bits.SetUInt(0, test);
   emp_assert(bits[0] == 0);
   emp_assert(bits[1] == 1);
+
+  // packed gradient scoring should count the same matching bits as bitvector EQU
+  emp::BitVector target = emp::BitVector(8);
+  target.SetUInt(0, 0xA5);
+  emp::BitVector gene = emp::BitVector(8);
+  gene.SetUInt(0, 0x3C);
+  emp_assert(target.EQU(gene).count() == 8 - emp::count_bits(target.GetUInt(0) ^ gene.GetUInt(0)));
+
+  // histogram and neighbors kept up to date by gene moves should match a full recalculation
+  emp::Random test_random(1);
+  AagosOrg moved_org(20, 6, 4);
+  moved_org.Randomize(test_random);
+  moved_org.GetHistCounts(); // calculate stats so moves update them in place
+  moved_org.MoveGene(0, 18);  // gene now loops around to front of genome
+  moved_org.MoveGene(3, 0);
+  AagosOrg fresh_org(moved_org);
+  fresh_org.ResetHistogram();
+  emp_assert(moved_org.GetHistCounts() == fresh_org.GetHistCounts());
+  emp_assert(moved_org.GetGeneNeighbors() == fresh_org.GetGeneNeighbors());
+
+  // vectorized coverage should match the scalar prefix sum and a count of every site
+  emp::vector<int> coverage_diffs;
+  for (size_t i = 0; i < 37; i++)
+    coverage_diffs.push_back((int)test_random.GetUInt(7) - 3);
+  emp::vector<int> coverage_scalar(coverage_diffs);
+  AagosCoverage::PrefixSumScalar(coverage_scalar.data(), coverage_scalar.size());
+  AagosCoverage::PrefixSum(coverage_diffs.data(), coverage_diffs.size());
+  emp_assert(coverage_diffs == coverage_scalar);
+  emp::vector<size_t> site_bins(fresh_org.GetHistCounts().size(), 0);
+  for (size_t site = 0; site < fresh_org.GetNumBits(); site++) {
+    size_t genes_on_site = 0;
+    for (size_t start : fresh_org.GetGeneStarts())
+      genes_on_site += (site + fresh_org.GetNumBits() - start) % fresh_org.GetNumBits() < 4;
+    site_bins[genes_on_site]++;
+  }
+  emp_assert(site_bins == fresh_org.GetHistCounts());
+
+  // genes running off the end should continue at the front for the genome's own length
+  AagosOrg wrap_org(37, 2, 8);
+  wrap_org.Randomize(test_random);
+  wrap_org.MoveGene(0, 33);
+  uint32_t wrap_val = 0;
+  for (size_t b = 0; b < 8; b++)
+    wrap_val |= (uint32_t)wrap_org.GetBits().Get((33 + b) % 37) << b;
+  emp_assert(wrap_org.GetGeneValue(0, 0xFF) == wrap_val);
+
+  // copies should share their parent's stats until changed, and changing one leaves the parent alone
+  AagosOrg cow_parent(40, 6, 4);
+  cow_parent.Randomize(test_random);
+  const emp::vector<size_t> parent_hist = cow_parent.GetHistCounts();
+  AagosOrg cow_child(cow_parent);
+  emp_assert(&cow_child.GetHistCounts() == &cow_parent.GetHistCounts());
+  cow_child.MoveGene(0, (cow_child.GetGeneStarts()[0] + 20) % 40);
+  emp_assert(cow_parent.GetHistCounts() == parent_hist);
+  emp_assert(cow_child.GetGeneStarts() != cow_parent.GetGeneStarts());
+  emp_assert(cow_child.GetBits() == cow_parent.GetBits());
+
+  // pooled genomes should copy exactly and hand released slots to the next copy
+  auto genome_pool = std::make_shared<AagosGenomePool>(64);
+  AagosOrg pooled_org(40, 6, 4, genome_pool);
+  pooled_org.Randomize(test_random);
+  {
+    AagosOrg pooled_copy(pooled_org);
+    emp_assert(pooled_copy.GetBits() == pooled_org.GetBits());
+    emp_assert(pooled_copy.GetBits().ToBitVector() == pooled_org.GetBits().ToBitVector());
+  }
+  AagosOrg reused_copy(pooled_org);
+  emp_assert(genome_pool->GetNumSlots() == 2);
+  emp_assert(reused_copy.GetBits() == pooled_org.GetBits());
+
+  // binary snapshots should read back exactly what was written
+  {
+    AagosSnapshotWriter writer("snapshot_test.bin", 6, 4, 7);
+    writer.Write(3, {emp::Ptr<AagosOrg>(&moved_org)}, {1.5});
+    writer.Write(8, {emp::Ptr<AagosOrg>(&moved_org), emp::Ptr<AagosOrg>(&fresh_org)}, {1.5, 2.5});
+  }
+  AagosSnapshotReader reader("snapshot_test.bin");
+  emp_assert(reader.IsValid());
+  const bool found_update = reader.SeekUpdate(5); // skips over update 3
+  emp_assert(found_update);
+  (void)found_update; // only read by asserts
+  emp_assert(reader.GetUpdate() == 8 && reader.GetNumOrgs() == 2);
+  emp_assert(reader.GetFitness(1) == 2.5);
+  emp_assert(reader.GetGenome(1) == fresh_org.GetBits().ToBitVector());
+  emp_assert(reader.GetGeneStarts(1) == fresh_org.GetGeneStarts());
+  emp_assert(reader.GetHistCounts(1) == fresh_org.GetHistCounts());
+  const bool read_past_end = reader.NextUpdate();
+  emp_assert(!read_past_end);
+  (void)read_past_end; // only read by asserts
+
+  // snapshots handed to a background writer should come out byte for byte the same
+  {
+    AsyncWriter async_writer(2);
+    AagosSnapshotWriter writer("snapshot_async_test.bin", 6, 4, 7, 0, &async_writer);
+    writer.Write(3, {emp::Ptr<AagosOrg>(&moved_org)}, {1.5});
+    writer.Write(8, {emp::Ptr<AagosOrg>(&moved_org), emp::Ptr<AagosOrg>(&fresh_org)}, {1.5, 2.5});
+  }
+  std::ifstream sync_file("snapshot_test.bin", std::ios::binary);
+  std::ifstream async_file("snapshot_async_test.bin", std::ios::binary);
+  emp_assert(std::string(std::istreambuf_iterator<char>(sync_file), {}) ==
+             std::string(std::istreambuf_iterator<char>(async_file), {}));
+
+  // hashed landscapes should give the same fitness for the same seed, and a redraw
+  // should change only the state redrawn
+  AagosHashedLandscape hashed_a(42, 4, 20);
+  AagosHashedLandscape hashed_b(42, 4, 20);
+  const double hashed_fitness = hashed_a.GetFitness(3, 1000000);
+  emp_assert(hashed_fitness >= 0.0 && hashed_fitness < 1.0);
+  emp_assert(hashed_fitness == hashed_b.GetFitness(3, 1000000));
+  hashed_a.Redraw(3, 1000000);
+  emp_assert(hashed_a.GetFitness(3, 1000000) != hashed_fitness);
+  emp_assert(hashed_a.GetFitness(3, 1000001) == hashed_b.GetFitness(3, 1000001));
+  emp_assert(hashed_a.GetFitness(2, 1000000) == hashed_b.GetFitness(2, 1000000));
+  (void)hashed_fitness; // only read by asserts
+  hashed_b.SetRedraws(3, 1000000, 1);
+  emp_assert(hashed_a.GetFitness(3, 1000000) == hashed_b.GetFitness(3, 1000000));
+
+  // output specs should drop blank column names and only pick updates in their window
+  AagosOutputSpec output_spec(" mean_fitness, rep_fitness,,coding_sites_mean ", 40000, 50000, 500);
+  emp_assert(output_spec.columns == emp::vector<std::string>({"mean_fitness", "rep_fitness", "coding_sites_mean"}));
+  emp_assert(!output_spec.IsOutputUpdate(39500) && output_spec.IsOutputUpdate(40000));
+  emp_assert(!output_spec.IsOutputUpdate(40250) && output_spec.IsOutputUpdate(50000));
+  emp_assert(!output_spec.IsOutputUpdate(50500));
   // emp_assert
 
   AagosConfig config;
@@ -33,6 +163,7 @@ int main(int argc, char* argv[])
 
   emp::Random random = emp::Random();
   AagosWorld world(random, config);
+  world.SetPopStruct_Mixed(true); // generations come from emp's selectors below
 
   // org[0].GetUIntAtBit(gene_pos)
   // Build a random initial population
@@ -80,4 +211,254 @@ int main(int argc, char* argv[])
       }
     }
   }
+
+  // specialized NK kernels should score every org exactly like the generic path
+  if (!config.GRADIENT_MODEL() && config.NUM_GENES() == 16 && config.GENE_SIZE() == 8) {
+    // kept in parentheses so the template's comma doesn't split emp_assert's arguments
+    for (size_t i = 0; i < world.GetSize(); i++)
+      emp_assert((world.CalcNKFitness<16, 8>(world[i], nullptr) == world.CalcFitnessGeneric(world[i], nullptr)));
+  }
+
+  // fitness carried across environment changes by rescoring only the touched genes
+  // should match scoring every gene from scratch
+  for (size_t i = 0; i < world.GetSize(); i++)
+    emp_assert(world.CalcFitnessID(i) == world.CalcFitnessGeneric(world[i], nullptr));
+
+  // a world resumed from a checkpoint should pick up exactly where the original left off
+  world.SaveCheckpoint("checkpoint_test.bin");
+  emp::Random resume_random = emp::Random();
+  AagosWorld resumed_world(resume_random, config);
+  const bool loaded = resumed_world.LoadCheckpoint("checkpoint_test.bin");
+  emp_assert(loaded);
+  (void)loaded; // only read by asserts
+  emp_assert(resumed_world.GetUpdate() == world.GetUpdate());
+  emp_assert(resumed_world.GetSize() == world.GetSize());
+  for (size_t i = 0; i < world.GetSize(); i++) {
+    emp_assert(resumed_world[i].GetBits() == world[i].GetBits());
+    emp_assert(resumed_world[i].GetGeneStarts() == world[i].GetGeneStarts());
+    emp_assert(resumed_world.CalcFitnessID(i) == world.CalcFitnessID(i));
+  }
+  emp_assert(resumed_world.GetRandom().GetUInt(1000000) == world.GetRandom().GetUInt(1000000));
+
+  // selecting straight from the fitness array should pick the same generations as emp's selectors
+  config.ELITE_COUNT(2);
+  emp::Random emp_select_random(5);
+  emp::Random array_select_random(5);
+  AagosWorld emp_select_world(emp_select_random, config);
+  AagosWorld array_select_world(array_select_random, config);
+  emp_select_world.SetPopStruct_Mixed(true);
+  emp_select_world.InitPopulation();
+  array_select_world.InitPopulation();
+  for (size_t gen = 0; gen < 20; gen++) {
+    emp_select_world.DoMutations(config.ELITE_COUNT());
+    emp::EliteSelect(emp_select_world, config.ELITE_COUNT(), 1);
+    emp::TournamentSelect(emp_select_world, config.TOURNAMENT_SIZE(), config.POP_SIZE() - config.ELITE_COUNT());
+    emp_select_world.Update();
+    array_select_world.RunUpdate();
+  }
+  emp_assert(array_select_world.GetSize() == emp_select_world.GetSize());
+  for (size_t i = 0; i < emp_select_world.GetSize(); i++) {
+    emp_assert(array_select_world[i].GetBits() == emp_select_world[i].GetBits());
+    emp_assert(array_select_world[i].GetGeneStarts() == emp_select_world[i].GetGeneStarts());
+  }
+
+  // a resumed run should drop the data file rows written after its checkpoint and
+  // write them again, leaving each file as an uninterrupted run would
+  const size_t stats_interval = config.STATISTICS_INTERVAL();
+  config.STATISTICS_INTERVAL(1);
+  config.OUTPUT_EVERY(1);
+  for (const std::string output_columns : {"", "mean_fitness"}) {
+    config.OUTPUT_COLUMNS(output_columns);
+    const emp::vector<std::string> data_files =
+      output_columns.empty() ? emp::vector<std::string>{"fitness.csv", "gene_stats.csv", "representative_org.csv"}
+                             : emp::vector<std::string>{"output.csv"};
+    emp::vector<std::string> full_data;
+    {
+      emp::Random output_random(9);
+      AagosWorld output_world(output_random, config);
+      output_world.InitPopulation();
+      for (size_t gen = 0; gen < 6; gen++) {
+        output_world.RunUpdate();
+        if (gen == 2)
+          output_world.SaveCheckpoint(config.DATA_FILEPATH() + "checkpoint.bin");
+      }
+    }
+    for (const std::string &data_file : data_files) {
+      std::ifstream full_csv(config.DATA_FILEPATH() + data_file);
+      full_data.emplace_back(std::istreambuf_iterator<char>(full_csv), std::istreambuf_iterator<char>());
+    }
+    config.RESUME("./"); // DATA_FILEPATH of the run above
+    {
+      emp::Random output_random(9);
+      AagosWorld output_world(output_random, config);
+      const bool output_loaded = output_world.LoadCheckpoint(config.RESUME() + "checkpoint.bin");
+      emp_assert(output_loaded);
+      (void)output_loaded; // only read by asserts
+      for (size_t gen = 3; gen < 6; gen++)
+        output_world.RunUpdate();
+    }
+    config.RESUME("");
+    for (size_t i = 0; i < data_files.size(); i++) {
+      std::ifstream resumed_csv(config.DATA_FILEPATH() + data_files[i]);
+      emp_assert(full_data[i].size() && std::string(std::istreambuf_iterator<char>(resumed_csv),
+                                                    std::istreambuf_iterator<char>()) == full_data[i], data_files[i]);
+    }
+  }
+  config.OUTPUT_COLUMNS("");
+  config.STATISTICS_INTERVAL(stats_interval);
+
+  // cyclic runs should keep each environment's fitness cached across switches
+  config.NUM_ENVIRONMENTS(3);
+  config.ENVIRONMENT_PERIOD(2);
+  emp::Random cyclic_random(7);
+  AagosWorld cyclic_world(cyclic_random, config);
+  cyclic_world.InitPopulation();
+  emp_assert(cyclic_world.EnvironmentForUpdate(5) == 2 && cyclic_world.EnvironmentForUpdate(6) == 0);
+  const double first_env_fitness = cyclic_world.CalcFitnessID(0);
+  cyclic_world.SwitchEnvironment(1);
+  emp_assert(cyclic_world.CalcFitnessID(0) == cyclic_world.CalcFitnessGeneric(cyclic_world[0], nullptr));
+  cyclic_world.SwitchEnvironment(0);
+  emp_assert(cyclic_world.CalcFitnessID(0) == first_env_fitness);
+  emp_assert(first_env_fitness == cyclic_world.CalcFitnessGeneric(cyclic_world[0], nullptr));
+  (void)first_env_fitness; // only read by asserts
+
+  // replaying the mutations kept by lineage tracking should rebuild every living org,
+  // and only ancestors of living orgs should be kept
+  config.LINEAGE_TRACKING(true);
+  emp::Random lineage_random(9);
+  AagosWorld lineage_world(lineage_random, config);
+  lineage_world.InitPopulation();
+  for (size_t gen = 0; gen < 30; gen++)
+    lineage_world.RunUpdate();
+  std::set<size_t> lineage_ancestors;
+  for (size_t i = 0; i < lineage_world.GetSize(); i++) {
+    const AagosOrg rebuilt_org = lineage_world.RebuildLineageOrg(lineage_world.GetLineageID(i));
+    emp_assert(rebuilt_org.GetBits() == lineage_world[i].GetBits());
+    emp_assert(rebuilt_org.GetGeneStarts() == lineage_world[i].GetGeneStarts());
+    for (size_t id : lineage_world.GetLineage().GetAncestry(lineage_world.GetLineageID(i)))
+      lineage_ancestors.insert(id);
+  }
+  emp_assert(lineage_ancestors.size() == lineage_world.GetLineage().GetNumNodes());
+
+  // a resumed run should carry on the ancestry saved in its checkpoint
+  lineage_world.SaveCheckpoint("checkpoint_lineage_test.bin");
+  emp::Random resumed_lineage_random(9);
+  AagosWorld resumed_lineage_world(resumed_lineage_random, config);
+  const bool lineage_loaded = resumed_lineage_world.LoadCheckpoint("checkpoint_lineage_test.bin");
+  emp_assert(lineage_loaded);
+  (void)lineage_loaded; // only read by asserts
+  for (size_t gen = 0; gen < 10; gen++) {
+    lineage_world.RunUpdate();
+    resumed_lineage_world.RunUpdate();
+  }
+  emp_assert(resumed_lineage_world.GetLineage().GetNumNodes() == lineage_world.GetLineage().GetNumNodes());
+  for (size_t i = 0; i < lineage_world.GetSize(); i++) {
+    std::stringstream ancestry;
+    std::stringstream resumed_ancestry;
+    lineage_world.GetLineage().WriteAncestry(ancestry, lineage_world.GetLineageID(i));
+    resumed_lineage_world.GetLineage().WriteAncestry(resumed_ancestry, resumed_lineage_world.GetLineageID(i));
+    emp_assert(resumed_lineage_world.GetLineageID(i) == lineage_world.GetLineageID(i));
+    emp_assert(resumed_ancestry.str() == ancestry.str());
+  }
+
+  // worlds sharing one set of mutation tables across threads, as AagosSweep runs
+  // them, should come out the same as worlds with tables of their own run one by one
+  config.LINEAGE_TRACKING(false);
+  {
+    auto shared_tables = std::make_shared<AagosMutationTables>(config);
+    emp::vector<std::unique_ptr<emp::Random>> shared_randoms;
+    emp::vector<std::unique_ptr<AagosWorld>> shared_worlds;
+    emp::vector<std::unique_ptr<emp::Random>> own_randoms;
+    emp::vector<std::unique_ptr<AagosWorld>> own_worlds;
+    for (int seed = 1; seed <= 4; seed++) {
+      shared_randoms.emplace_back(new emp::Random(seed));
+      shared_worlds.emplace_back(new AagosWorld(*shared_randoms.back(), config, "AagosWorld", shared_tables));
+      shared_worlds.back()->InitPopulation();
+      own_randoms.emplace_back(new emp::Random(seed));
+      own_worlds.emplace_back(new AagosWorld(*own_randoms.back(), config));
+      own_worlds.back()->InitPopulation();
+    }
+    ThreadPool sweep_pool(4);
+    sweep_pool.RunTasks(shared_worlds.size(), [&shared_worlds](size_t k, size_t) {
+      for (size_t gen = 0; gen < 10; gen++)
+        shared_worlds[k]->RunUpdate();
+    });
+    for (size_t k = 0; k < own_worlds.size(); k++) {
+      for (size_t gen = 0; gen < 10; gen++)
+        own_worlds[k]->RunUpdate();
+      for (size_t i = 0; i < own_worlds[k]->GetSize(); i++) {
+        emp_assert((*shared_worlds[k])[i].GetBits() == (*own_worlds[k])[i].GetBits());
+        emp_assert((*shared_worlds[k])[i].GetGeneStarts() == (*own_worlds[k])[i].GetGeneStarts());
+      }
+    }
+  }
+
+  // island runs should come out the same on any number of threads, migrations included
+  config.NUM_DEMES(2);
+  config.MIGRATION_INTERVAL(5);
+  config.SEED(11);
+  config.NUM_THREADS(1);
+  AagosIslands serial_islands(config);
+  config.NUM_THREADS(2);
+  AagosIslands parallel_islands(config);
+  serial_islands.InitPopulation();
+  parallel_islands.InitPopulation();
+  serial_islands.Run(12);
+  parallel_islands.Run(12);
+  emp_assert(serial_islands.GetUpdate() == 12 && parallel_islands.GetUpdate() == 12);
+  for (size_t k = 0; k < serial_islands.GetNumDemes(); k++) {
+    emp_assert(serial_islands.GetDeme(k).GetSize() == config.POP_SIZE() / 2);
+    for (size_t i = 0; i < serial_islands.GetDeme(k).GetSize(); i++) {
+      emp_assert(serial_islands.GetDeme(k)[i].GetBits() == parallel_islands.GetDeme(k)[i].GetBits());
+      emp_assert(serial_islands.GetDeme(k)[i].GetGeneStarts() == parallel_islands.GetDeme(k)[i].GetGeneStarts());
+    }
+  }
+
+  // a resumed island run should carry on exactly where the last checkpoint every
+  // deme reached left it, with the deme files of older checkpoints cleaned up
+  config.CHECKPOINT_INTERVAL(4);
+  {
+    AagosIslands checkpoint_islands(config);
+    checkpoint_islands.InitPopulation();
+    checkpoint_islands.Run(10);
+  }
+  emp_assert(!std::ifstream(config.DATA_FILEPATH() + "deme_0/checkpoint_4.bin").good());
+  emp_assert(std::ifstream(config.DATA_FILEPATH() + "deme_1/checkpoint_8.bin").good());
+  config.RESUME("./");
+  {
+    AagosIslands resumed_islands(config);
+    const bool islands_loaded = resumed_islands.LoadCheckpoints(config.RESUME());
+    emp_assert(islands_loaded && resumed_islands.GetUpdate() == 8);
+    (void)islands_loaded; // only read by asserts
+    resumed_islands.Run(4);
+    for (size_t k = 0; k < serial_islands.GetNumDemes(); k++) {
+      for (size_t i = 0; i < serial_islands.GetDeme(k).GetSize(); i++) {
+        emp_assert(serial_islands.GetDeme(k)[i].GetBits() == resumed_islands.GetDeme(k)[i].GetBits());
+        emp_assert(serial_islands.GetDeme(k)[i].GetGeneStarts() == resumed_islands.GetDeme(k)[i].GetGeneStarts());
+      }
+    }
+    // a deme checkpoint from another update than the manifest's must not be resumed from
+    resumed_islands.GetDeme(1).RunUpdate();
+    resumed_islands.GetDeme(1).SaveCheckpoint(config.DATA_FILEPATH() + "deme_1/checkpoint_12.bin");
+  }
+  {
+    AagosIslands mismatched_islands(config);
+    const bool mismatched_loaded = mismatched_islands.LoadCheckpoints(config.RESUME());
+    emp_assert(!mismatched_loaded);
+    (void)mismatched_loaded; // only read by asserts
+  }
+  config.RESUME("");
+  config.CHECKPOINT_INTERVAL(0);
+
+  // orgs left over by an uneven split should go to the first demes, not be dropped
+  config.NUM_DEMES(3);
+  AagosIslands uneven_islands(config);
+  uneven_islands.InitPopulation();
+  size_t island_orgs = 0;
+  for (size_t k = 0; k < uneven_islands.GetNumDemes(); k++) {
+    emp_assert(uneven_islands.GetDeme(k).GetSize() == config.POP_SIZE() / 3 + (k < config.POP_SIZE() % 3));
+    island_orgs += uneven_islands.GetDeme(k).GetSize();
+  }
+  emp_assert(island_orgs == config.POP_SIZE());
+  (void)island_orgs; // only read by asserts
 }